@@ -1,130 +1,819 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
 #include <cstring>
+#include <functional>
+#include <initializer_list>
 #include <lzma.h>
-#include <microtar.h>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <zlib.h>
+#include <zstd.h>
+
+#include "workers.hpp"
 
 namespace archive {
 
 ///
-/// Unpack GZIP byte array
+/// Build CRC tables and select CRC code for this CPU once
 ///
-inline auto gzip_unpack(std::vector<uint8_t>& raw_gzip) -> std::vector<uint8_t>
+inline auto crc_prepare() -> void
 {
-    z_stream zstream {};
+    static auto const prepared = (CrcGenerateTable(), Crc64GenerateTable(), true);
+    (void)prepared;
+}
 
-    // Add 32 to windowBits to enable zlib and gzip decoding with automatic
-    // header detection, or add 16 to decode only the gzip format.
-    // Magic number 32 = enable zlib and gzip decoding with automatic header detection
-    auto z_result = inflateInit2(&zstream, 32);
-    if (z_result != Z_OK)
-        throw std::runtime_error("GZIP inflate init error");
-
-    zstream.next_in = raw_gzip.data(); // input byte array
-    zstream.avail_in = raw_gzip.size(); // size of input
-
-    constexpr size_t block_size = 1 << 20; // 1 Mb
-    auto buffer = std::array<uint8_t, block_size> {};
-    auto result = std::vector<uint8_t> {}; // result array
-    do {
-        zstream.next_out = buffer.data(); // output byte array
-        zstream.avail_out = buffer.size(); // size of output
-        z_result = inflate(&zstream, Z_SYNC_FLUSH);
-        result.insert(result.cend(), buffer.cbegin(), buffer.cend());
-    } while (z_result == Z_OK);
-    inflateEnd(&zstream);
-
-    if (z_result != Z_STREAM_END)
-        throw std::runtime_error { "GZIP " + std::string(zstream.msg) };
-    return result;
+///
+/// Check CRC32 and size of unpacked data with 8 bytes of GZIP trailer.
+/// GZIP data is checked here instead of zlib to use the fastest CRC code
+///
+inline auto gzip_check_trailer(uint32_t crc, uint64_t size, uint8_t const* trailer) -> void
+{
+    auto read32 = [](uint8_t const* p) { return uint32_t { p[0] } | uint32_t { p[1] } << 8 | uint32_t { p[2] } << 16 | uint32_t { p[3] } << 24; };
+    if (read32(trailer) != crc)
+        throw std::runtime_error("GZIP incorrect data check");
+    if (read32(trailer + 4) != static_cast<uint32_t>(size))
+        throw std::runtime_error("GZIP incorrect length check");
 }
 
 ///
-/// Unpack XZ byte array
+/// Check that data starts with GZIP magic number
 ///
-inline auto xz_unpack(std::vector<uint8_t>& raw_xz) -> std::vector<uint8_t>
+inline auto is_gzip(uint8_t const* data, size_t size) -> bool
 {
-    CXzUnpacker xz_stream {};
-    XzUnpacker_Init(&xz_stream);
-    CrcGenerateTable();
-    Crc64GenerateTable();
-
-    const ISzAlloc xz_alloc = {
-        [](ISzAllocPtr, size_t size) { return malloc(size); },
-        [](ISzAllocPtr, void* address) { free(address); }
+    return size >= 2 && data[0] == 0x1F && data[1] == 0x8B;
+}
+
+///
+/// Receiver of unpacked data chunks
+///
+using sink = std::function<void(uint8_t const* data, size_t size)>;
+
+///
+/// Streaming GZIP decoder: unpacks input chunks as they arrive
+/// and passes unpacked data to `sink` chunk by chunk
+///
+class gzip_stream {
+public:
+    explicit gzip_stream(sink write)
+        : write { std::move(write) }
+    {
+        // Magic number 32 = enable zlib and gzip decoding with automatic header detection
+        if (inflateInit2(&zstream, 32) != Z_OK)
+            throw std::runtime_error("GZIP inflate init error");
+    }
+
+    ~gzip_stream()
+    {
+        inflateEnd(&zstream);
+    }
+
+    gzip_stream(gzip_stream const&) = delete;
+    auto operator=(gzip_stream const&) -> gzip_stream& = delete;
+
+    ///
+    /// Unpack next chunk of GZIP data
+    ///
+    auto push(uint8_t const* data, size_t size) -> void
+    {
+        if (z_result == Z_STREAM_END)
+            return; // ignore trailing data
+        if (!started) {
+            started = true;
+            own_check = is_gzip(data, size);
+            if (own_check) {
+                crc_prepare();
+                inflateValidate(&zstream, 0);
+            }
+        }
+
+        zstream.next_in = const_cast<uint8_t*>(data); // input byte array
+        zstream.avail_in = size; // size of input
+        do {
+            zstream.next_out = buffer.data(); // output byte array
+            zstream.avail_out = buffer.size(); // size of output
+            z_result = inflate(&zstream, Z_NO_FLUSH);
+            if (z_result != Z_OK && z_result != Z_STREAM_END && z_result != Z_BUF_ERROR)
+                throw std::runtime_error { "GZIP " + std::string(zstream.msg ? zstream.msg : "inflate error") };
+            if (auto unpacked = buffer.size() - zstream.avail_out; unpacked > 0) {
+                if (own_check) {
+                    crc = CrcUpdate(crc, buffer.data(), unpacked);
+                    total += unpacked;
+                }
+                write(buffer.data(), unpacked);
+            }
+        } while (zstream.avail_out == 0 && z_result != Z_STREAM_END);
+
+        // last 8 bytes of read data are the trailer at the end of stream
+        auto consumed = size - zstream.avail_in;
+        auto kept = tail.size() - std::min(consumed, tail.size()); // bytes of previous chunks
+        std::copy(tail.end() - kept, tail.end(), tail.begin());
+        std::copy(data + consumed - (tail.size() - kept), data + consumed, tail.begin() + kept);
+        if (z_result == Z_STREAM_END && own_check)
+            gzip_check_trailer(CRC_GET_DIGEST(crc), total, tail.data());
+    }
+
+    ///
+    /// Check that all GZIP data has been unpacked
+    ///
+    auto finish() -> void
+    {
+        if (z_result != Z_STREAM_END)
+            throw std::runtime_error("GZIP unexpected end of data");
+    }
+
+private:
+    sink write {};
+    z_stream zstream {};
+    int z_result = Z_OK;
+    std::vector<uint8_t> buffer = std::vector<uint8_t>(256 * 1024);
+    bool started = false; // first chunk is pushed
+    bool own_check = false; // GZIP trailer is checked here, not by zlib
+    uint32_t crc = CRC_INIT_VAL;
+    uint64_t total = 0; // size of unpacked data
+    std::array<uint8_t, 8> tail {}; // last 8 bytes of read data
+};
+
+///
+/// Memory allocator for XZ decoder
+///
+inline const ISzAlloc xz_alloc = {
+    [](ISzAllocPtr, size_t size) { return malloc(size); },
+    [](ISzAllocPtr, void* address) { free(address); }
+};
+
+///
+/// Block of XZ stream taken from stream index
+///
+struct xz_block {
+    size_t pack_offset; // offset of block header in XZ byte array
+    size_t pack_size; // size of block with header, padding and check
+    size_t unpack_offset; // offset of block data in unpacked byte array
+    size_t unpack_size; // size of block data
+};
+
+constexpr size_t xz_max_group_size = 256 << 20; // unpacked blocks kept in memory at once
+
+///
+/// Read list of blocks from index at the end of XZ byte array.
+/// Returns empty list if data isn't exactly one XZ stream with valid index
+/// or a block is bigger than `xz_max_group_size` unpacked.
+///
+inline auto xz_get_blocks(std::vector<uint8_t> const& raw_xz, CXzStreamFlags& flags) -> std::vector<xz_block>
+{
+    auto get_ui32 = [](uint8_t const* p) -> size_t {
+        return size_t { p[0] } | size_t { p[1] } << 8 | size_t { p[2] } << 16 | size_t { p[3] } << 24;
     };
-    XzUnpacker_Construct(&xz_stream, &xz_alloc);
-
-    constexpr size_t block_size = 64 * 1024; // 1 << 20; // 1 Mb
-    auto buffer = std::array<uint8_t, block_size> {};
-    auto result = std::vector<uint8_t> {}; // result array
-    auto xz_result = SZ_OK;
-    auto xz_status = ECoderStatus {};
-    auto raw_xz_start = raw_xz.data();
-    auto raw_xz_size = raw_xz.size();
-    do {
-        auto buffer_size = buffer.size();
-        auto in_size = raw_xz_size;
-        xz_result = XzUnpacker_Code(&xz_stream, buffer.data(), &buffer_size,
-            raw_xz_start, &in_size, (in_size == 0), CODER_FINISH_ANY, &xz_status);
-        result.insert(result.cend(), buffer.cbegin(), buffer.cbegin() + buffer_size);
-        raw_xz_start += in_size;
-        raw_xz_size -= in_size;
-    } while (xz_result == SZ_OK && xz_status == CODER_STATUS_NOT_FINISHED);
-
-    XzUnpacker_Free(&xz_stream);
+
+    if (raw_xz.size() < XZ_STREAM_HEADER_SIZE + XZ_STREAM_FOOTER_SIZE || Xz_ParseHeader(&flags, raw_xz.data()) != SZ_OK)
+        return {};
+
+    // stream footer: CRC32, backward size, stream flags, footer magic bytes
+    auto footer = raw_xz.data() + raw_xz.size() - XZ_STREAM_FOOTER_SIZE;
+    if (footer[10] != XZ_FOOTER_SIG_0 || footer[11] != XZ_FOOTER_SIG_1 || std::memcmp(footer + 8, raw_xz.data() + XZ_SIG_SIZE, 2) != 0)
+        return {};
+    if (CrcCalc(footer + 4, 6) != get_ui32(footer))
+        return {};
+
+    // stream index: indicator, number of records, records, padding, CRC32
+    auto index_size = (get_ui32(footer + 4) + 1) * 4;
+    if (index_size > raw_xz.size() - XZ_STREAM_HEADER_SIZE - XZ_STREAM_FOOTER_SIZE)
+        return {};
+    auto index = footer - index_size;
+    if (index[0] != 0 || CrcCalc(index, index_size - 4) != get_ui32(index + index_size - 4))
+        return {};
+
+    auto pos = size_t { 1 };
+    auto read_varint = [&](UInt64& value) {
+        auto size = Xz_ReadVarInt(index + pos, index_size - 4 - pos, &value);
+        pos += size;
+        return size != 0;
+    };
+
+    auto count = UInt64 { 0 };
+    if (!read_varint(count) || count > index_size / 2)
+        return {};
+
+    // sizes come from the archive: every block must lie before the index
+    // and offsets must never wrap, else blocks would be unpacked out of their buffer
+    auto result = std::vector<xz_block>(count);
+    auto index_offset = static_cast<size_t>(index - raw_xz.data());
+    auto pack_offset = size_t { XZ_STREAM_HEADER_SIZE };
+    auto unpack_offset = size_t { 0 };
+    for (auto& block : result) {
+        auto unpadded_size = UInt64 { 0 };
+        auto unpack_size = UInt64 { 0 };
+        if (!read_varint(unpadded_size) || !read_varint(unpack_size))
+            return {};
+        if (unpadded_size == 0 || unpadded_size > index_offset - pack_offset || unpack_size > xz_max_group_size)
+            return {};
+        block = { pack_offset, (static_cast<size_t>(unpadded_size) + 3) & ~size_t { 3 }, unpack_offset, static_cast<size_t>(unpack_size) };
+        if (block.pack_size > index_offset - pack_offset || block.unpack_size > SIZE_MAX - unpack_offset)
+            return {};
+        pack_offset += block.pack_size;
+        unpack_offset += block.unpack_size;
+    }
+
+    // all blocks must end right at the index
+    if (pack_offset != index_offset)
+        return {};
     return result;
 }
 
 ///
-/// Get file list from TAR byte array
+/// Unpack independent blocks `first`..`last` of XZ byte array by up to `threads` tasks
+/// of the shared executor, the current thread works too.
+/// Every block is unpacked right into its place of `output` that starts with block `first`
 ///
-inline auto tar_get_file_list(std::vector<uint8_t>& raw_tar) -> std::vector<std::string>
+inline auto xz_unpack_blocks(std::vector<uint8_t> const& raw_xz, CXzStreamFlags flags, xz_block const* first, xz_block const* last, uint8_t* output, unsigned threads) -> void
 {
-    auto tar = mtar_t {};
-    auto tar_hdr = mtar_header_t {};
-
-    tar.stream = raw_tar.data();
-    tar.seek = [](mtar_t*, unsigned) -> int { return MTAR_ESUCCESS; };
-    tar.close = [](mtar_t*) -> int { return MTAR_ESUCCESS; };
-    tar.read = [](mtar_t* tar, void* data, unsigned size) -> int {
-        std::memcpy(data, reinterpret_cast<uint8_t*>(tar->stream) + tar->pos, size);
-        return MTAR_ESUCCESS;
+    auto next = std::atomic<size_t> { 0 }; // index of next block to unpack
+    auto failed = std::atomic<bool> { false };
+    auto count = static_cast<size_t>(last - first);
+
+    auto worker = [&]() {
+        CXzUnpacker xz_stream {};
+        XzUnpacker_Construct(&xz_stream, &xz_alloc);
+        for (auto index = next++; index < count && !failed; index = next++) {
+            auto const& block = first[index];
+            XzUnpacker_Init(&xz_stream);
+            xz_stream.streamFlags = flags;
+            XzUnpacker_PrepareToRandomBlockDecoding(&xz_stream);
+            XzUnpacker_SetOutBuf(&xz_stream, output + (block.unpack_offset - first->unpack_offset), block.unpack_size);
+
+            auto out_size = SizeT { block.unpack_size };
+            auto in_size = SizeT { block.pack_size };
+            auto xz_status = ECoderStatus {};
+            auto xz_result = XzUnpacker_Code(&xz_stream, nullptr, &out_size,
+                raw_xz.data() + block.pack_offset, &in_size, true, CODER_FINISH_END, &xz_status);
+            if (xz_result != SZ_OK || xz_status != CODER_STATUS_FINISHED_WITH_MARK || out_size != block.unpack_size || in_size != block.pack_size)
+                failed = true;
+        }
+        XzUnpacker_Free(&xz_stream);
     };
 
-    auto result = std::vector<std::string> {};
-    while ((mtar_read_header(&tar, &tar_hdr)) != MTAR_ENULLRECORD) {
-        result.emplace_back(tar_hdr.name);
-        mtar_next(&tar);
+    workers::task_group tasks { workers::shared_executor() };
+    for (unsigned i = 1; i < std::min<size_t>(threads, count); i++)
+        tasks.run(worker);
+    worker();
+    tasks.wait();
+
+    if (failed)
+        throw std::runtime_error("XZ block unpack error");
+}
+
+///
+/// Streaming XZ decoder: unpacks input chunks as they arrive
+/// and passes unpacked data to `sink` chunk by chunk
+///
+class xz_stream {
+public:
+    explicit xz_stream(sink write)
+        : write { std::move(write) }
+    {
+        crc_prepare();
+        XzUnpacker_Construct(&xz_state, &xz_alloc);
+        XzUnpacker_Init(&xz_state);
     }
 
-    return result;
+    ~xz_stream()
+    {
+        XzUnpacker_Free(&xz_state);
+    }
+
+    xz_stream(xz_stream const&) = delete;
+    auto operator=(xz_stream const&) -> xz_stream& = delete;
+
+    ///
+    /// Unpack next chunk of XZ data
+    ///
+    auto push(uint8_t const* data, size_t size) -> void
+    {
+        auto out_size = SizeT { 0 };
+        do {
+            out_size = buffer.size();
+            auto in_size = SizeT { size };
+            auto xz_status = ECoderStatus {};
+            if (XzUnpacker_Code(&xz_state, buffer.data(), &out_size, data, &in_size, false, CODER_FINISH_ANY, &xz_status) != SZ_OK)
+                throw std::runtime_error("XZ unpack error");
+            if (out_size > 0)
+                write(buffer.data(), out_size);
+            if (in_size == 0 && out_size == 0)
+                break; // nothing more is taken from this chunk
+            data += in_size;
+            size -= in_size;
+        } while (size > 0 || out_size == buffer.size());
+    }
+
+    ///
+    /// Check that all XZ data has been unpacked
+    ///
+    auto finish() -> void
+    {
+        if (!XzUnpacker_IsStreamWasFinished(&xz_state))
+            throw std::runtime_error("XZ unexpected end of data");
+    }
+
+private:
+    sink write {};
+    CXzUnpacker xz_state {};
+    std::vector<uint8_t> buffer = std::vector<uint8_t>(256 * 1024);
+};
+
+///
+/// Unpack XZ byte array to `write` chunk by chunk. Streams of many blocks are unpacked
+/// by groups of blocks in `threads` tasks, one per worker of the shared executor by default.
+/// Only one group is kept in memory: up to `threads` blocks of `xz_max_group_size` bytes together.
+///
+inline auto xz_unpack_to(std::vector<uint8_t>& raw_xz, sink const& write, unsigned threads = static_cast<unsigned>(workers::shared_executor().get_thread_count())) -> void
+{
+    crc_prepare();
+
+    auto flags = CXzStreamFlags {};
+    auto blocks = (threads > 1) ? xz_get_blocks(raw_xz, flags) : std::vector<xz_block> {};
+    if (blocks.size() < 2) {
+        xz_stream stream { write };
+        stream.push(raw_xz.data(), raw_xz.size());
+        stream.finish();
+        return;
+    }
+
+    auto group = std::vector<uint8_t> {};
+    for (size_t first = 0, last = 0; first < blocks.size(); first = last) {
+        auto size = blocks[first].unpack_size; // a block alone is never bigger than the limit
+        for (last = first + 1; last < blocks.size() && last - first < threads && size + blocks[last].unpack_size <= xz_max_group_size; last++)
+            size += blocks[last].unpack_size;
+        group.resize(blocks[last - 1].unpack_offset + blocks[last - 1].unpack_size - blocks[first].unpack_offset);
+        xz_unpack_blocks(raw_xz, flags, blocks.data() + first, blocks.data() + last, group.data(), threads);
+        write(group.data(), group.size());
+    }
+}
+
+///
+/// Streaming ZSTD decoder: unpacks input chunks as they arrive
+/// and passes unpacked data to `sink` chunk by chunk
+///
+class zstd_stream {
+public:
+    explicit zstd_stream(sink write)
+        : write { std::move(write) }
+    {
+        if (zstd_state == nullptr)
+            throw std::runtime_error("ZSTD decoder init error");
+    }
+
+    zstd_stream(zstd_stream const&) = delete;
+    auto operator=(zstd_stream const&) -> zstd_stream& = delete;
+
+    ///
+    /// Unpack next chunk of ZSTD data
+    ///
+    auto push(uint8_t const* data, size_t size) -> void
+    {
+        auto input = ZSTD_inBuffer { data, size, 0 };
+        auto output = ZSTD_outBuffer {};
+        do {
+            output = { buffer.data(), buffer.size(), 0 };
+            zstd_result = ZSTD_decompressStream(zstd_state.get(), &output, &input);
+            if (ZSTD_isError(zstd_result))
+                throw std::runtime_error { "ZSTD " + std::string(ZSTD_getErrorName(zstd_result)) };
+            if (output.pos > 0)
+                write(buffer.data(), output.pos);
+        } while (input.pos < input.size || output.pos == output.size);
+    }
+
+    ///
+    /// Check that all ZSTD data has been unpacked
+    ///
+    auto finish() -> void
+    {
+        if (zstd_result != 0)
+            throw std::runtime_error("ZSTD unexpected end of data");
+    }
+
+private:
+    sink write {};
+    std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> zstd_state { ZSTD_createDCtx(), ZSTD_freeDCtx };
+    size_t zstd_result = 1; // 0 when a frame is completely unpacked
+    std::vector<uint8_t> buffer = std::vector<uint8_t>(ZSTD_DStreamOutSize());
+};
+
+///
+/// Compression format of archive
+///
+enum class format {
+    unknown,
+    gzip,
+    xz,
+    zstd,
+};
+
+///
+/// Detect compression format by magic bytes at the start of data
+///
+inline auto detect_format(uint8_t const* data, size_t size) -> format
+{
+    auto starts_with = [data, size](std::initializer_list<uint8_t> magic) {
+        return size >= magic.size() && std::equal(magic.begin(), magic.end(), data);
+    };
+
+    if (starts_with({ 0x1F, 0x8B }))
+        return format::gzip;
+    if (starts_with({ 0xFD, '7', 'z', 'X', 'Z', 0x00 }))
+        return format::xz;
+    if (starts_with({ 0x28, 0xB5, 0x2F, 0xFD }))
+        return format::zstd;
+    return format::unknown;
 }
 
 ///
-/// Get file list from TAR byte array
+/// Unpack GZIP, XZ or ZSTD byte array to `write` chunk by chunk,
+/// the unpacked data is never kept in memory as a whole
 ///
-inline auto tar_get_file(std::vector<uint8_t>& raw_tar, std::string const& name) -> std::vector<uint8_t>
+inline auto unpack_to(std::vector<uint8_t>& raw, sink const& write) -> void
 {
-    auto tar = mtar_t {};
-    auto tar_hdr = mtar_header_t {};
-
-    tar.stream = raw_tar.data();
-    tar.seek = [](mtar_t*, unsigned) -> int { return MTAR_ESUCCESS; };
-    tar.close = [](mtar_t*) -> int { return MTAR_ESUCCESS; };
-    tar.read = [](mtar_t* tar, void* data, unsigned size) -> int {
-        std::memcpy(data, reinterpret_cast<uint8_t*>(tar->stream) + tar->pos, size);
-        return MTAR_ESUCCESS;
+    auto stream_to = [&raw](auto&& stream) {
+        stream.push(raw.data(), raw.size());
+        stream.finish();
     };
 
-    mtar_find(&tar, name.c_str(), &tar_hdr);
-    auto result = std::vector<uint8_t>(tar_hdr.size);
-    mtar_read_data(&tar, result.data(), tar_hdr.size);
+    switch (detect_format(raw.data(), raw.size())) {
+    case format::gzip:
+        return stream_to(gzip_stream { write });
+    case format::xz:
+        return xz_unpack_to(raw, write);
+    case format::zstd:
+        return stream_to(zstd_stream { write });
+    default:
+        throw std::runtime_error("Unknown archive format");
+    }
+}
 
-    return result;
+///
+/// Type of TAR entry
+///
+enum class tar_type : char {
+    file = '0',
+    hard_link = '1',
+    symlink = '2',
+    character_device = '3',
+    block_device = '4',
+    directory = '5',
+    fifo = '6',
+};
+
+///
+/// Entry of TAR byte array
+///
+struct tar_entry {
+    std::string name; // full name of entry
+    std::string linkname; // target of link
+    tar_type type; // type of entry
+    uint32_t mode; // permission bits
+    int64_t mtime; // time of last change in seconds since epoch
+    uint64_t offset; // offset of entry data in TAR data
+    uint64_t size; // size of entry data
+};
+
+///
+/// Parse numeric field of TAR header: octal number ended by space or zero,
+/// or big-endian two's complement number with high bit of the first byte set (base-256)
+///
+inline auto tar_parse_number(uint8_t const* field, size_t size) -> int64_t
+{
+    if (size > 0 && (field[0] & 0x80) != 0) {
+        auto value = static_cast<uint64_t>((field[0] & 0x40) != 0 ? -1 : 0); // sign of number
+        for (size_t i = 0; i < size; i++)
+            value = (value << 8) | ((i == 0) ? (field[0] & 0x7F) | (field[0] & 0x40) << 1 : field[i]);
+        return static_cast<int64_t>(value);
+    }
+
+    auto value = uint64_t { 0 };
+    auto i = size_t { 0 };
+    while (i < size && field[i] == ' ')
+        i++;
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+        value = (value << 3) | (field[i] - '0');
+    return static_cast<int64_t>(value);
 }
 
+///
+/// Streaming TAR parser: takes chunks of TAR data as they arrive from decoder
+/// and passes entries to `visit` on the fly. Data is kept only for entries taken
+/// by `select` and only while it spans chunks, so memory is bounded by the largest
+/// taken entry instead of the whole archive.
+/// POSIX ustar, GNU long names (`././@LongLink`), PAX extended headers and
+/// base-256 numbers are read, sizes and offsets are 64 bit.
+///
+class tar_stream {
+public:
+    using selector = std::function<bool(tar_entry const& entry)>;
+    using visitor = std::function<void(tar_entry const& entry, uint8_t const* data)>;
+
+    tar_stream(selector select, visitor visit)
+        : select { std::move(select) }
+        , visit { std::move(visit) }
+    {
+    }
+
+    tar_stream(tar_stream const&) = delete;
+    auto operator=(tar_stream const&) -> tar_stream& = delete;
+
+    ///
+    /// Parse next chunk of TAR data
+    ///
+    auto push(uint8_t const* data, size_t size) -> void
+    {
+        while (size > 0 && !ended) {
+            if (remaining == 0 && padding == 0) {
+                // collect header record, it may span chunks too
+                auto taken = std::min(record.size() - record_size, size);
+                std::memcpy(record.data() + record_size, data, taken);
+                record_size += taken;
+                data += taken;
+                size -= taken;
+                if (record_size == record.size())
+                    read_header();
+                continue;
+            }
+
+            auto taken = static_cast<size_t>(std::min<uint64_t>(remaining, size));
+            if (taken > 0) {
+                if (meta != 0) {
+                    buffer.insert(buffer.end(), data, data + taken);
+                    if (buffer.size() == entry.size)
+                        read_meta();
+                } else if (selected && taken == entry.size) {
+                    visit(entry, data); // whole data is in this chunk
+                } else if (selected) {
+                    buffer.insert(buffer.end(), data, data + taken);
+                    if (buffer.size() == entry.size)
+                        visit(entry, buffer.data());
+                }
+                remaining -= taken;
+            } else {
+                taken = static_cast<size_t>(std::min<uint64_t>(padding, size));
+                padding -= taken;
+            }
+            data += taken;
+            size -= taken;
+            position += taken;
+        }
+    }
+
+    ///
+    /// Check that TAR data ends at the end of entry
+    ///
+    auto finish() -> void
+    {
+        if (remaining != 0 || padding != 0 || record_size != 0 || meta != 0)
+            throw std::runtime_error { "TAR entry `" + entry.name + "` is out of archive" };
+    }
+
+private:
+    ///
+    /// Fields of entry given by GNU long name records and PAX extended headers
+    ///
+    struct extension {
+        std::optional<std::string> name;
+        std::optional<std::string> linkname;
+        std::optional<uint64_t> size;
+        std::optional<int64_t> mtime;
+    };
+
+    static constexpr size_t max_meta_size = 1 << 20; // limit of long name or PAX header
+
+    auto read_header() -> void
+    {
+        auto text = [this](size_t offset, size_t size) {
+            auto start = reinterpret_cast<char const*>(record.data() + offset);
+            return std::string(start, std::find(start, start + size, '\0'));
+        };
+
+        record_size = 0;
+        position += record.size();
+        if (std::all_of(record.cbegin(), record.cend(), [](uint8_t value) { return value == 0; })) {
+            ended = true; // end of archive
+            return;
+        }
+
+        // checksum is the sum of header bytes with spaces in place of checksum field
+        auto sum = int64_t { 0 }, signed_sum = int64_t { 0 };
+        for (size_t i = 0; i < record.size(); i++) {
+            auto value = (i >= 148 && i < 156) ? uint8_t { ' ' } : record[i];
+            sum += value;
+            signed_sum += static_cast<int8_t>(value);
+        }
+        auto checksum = tar_parse_number(record.data() + 148, 8);
+        if (checksum != sum && checksum != signed_sum)
+            throw std::runtime_error { "TAR wrong header checksum at " + std::to_string(position - record.size()) };
+
+        auto type = static_cast<char>(record[156]);
+        auto size = tar_parse_number(record.data() + 124, 12);
+        if (size < 0)
+            throw std::runtime_error { "TAR wrong entry size at " + std::to_string(position - record.size()) };
+        auto name = text(0, 100);
+        if (std::memcmp(record.data() + 257, "ustar\0", 6) == 0 && record[345] != 0) // POSIX ustar prefix
+            name = text(345, 155) + '/' + name;
+
+        entry = { std::move(name), text(157, 100), tar_type::file, static_cast<uint32_t>(tar_parse_number(record.data() + 100, 8)),
+            tar_parse_number(record.data() + 136, 12), position, static_cast<uint64_t>(size) };
+        remaining = entry.size;
+        padding = (512 - entry.size % 512) % 512;
+        buffer.clear();
+
+        // GNU long name or link name, PAX header of the next entry or global PAX header
+        if (type == 'L' || type == 'K' || type == 'x' || type == 'g') {
+            if (entry.size > max_meta_size)
+                throw std::runtime_error { "TAR too long extended header at " + std::to_string(position - record.size()) };
+            meta = type;
+            if (entry.size == 0)
+                read_meta();
+            return;
+        }
+
+        apply(global);
+        apply(local);
+        local = {};
+        remaining = entry.size;
+        padding = (512 - entry.size % 512) % 512;
+        switch (type) {
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '5':
+        case '6':
+            entry.type = static_cast<tar_type>(type);
+            break;
+        default: // '0', old '\0', contiguous '7' and unknown types are regular files
+            entry.type = tar_type::file;
+            break;
+        }
+
+        selected = select(entry);
+        if (selected && entry.size == 0)
+            visit(entry, record.data());
+    }
+
+    auto read_meta() -> void
+    {
+        auto value = std::string(buffer.begin(), buffer.end());
+        if (meta == 'L' || meta == 'K') {
+            value.erase(std::find(value.begin(), value.end(), '\0'), value.end());
+            (meta == 'L' ? local.name : local.linkname) = std::move(value);
+        } else {
+            read_pax(value, (meta == 'x') ? local : global);
+        }
+        meta = 0;
+        buffer.clear();
+    }
+
+    ///
+    /// Read PAX records `<length> <key>=<value>\n`
+    ///
+    auto read_pax(std::string_view records, extension& fields) -> void
+    {
+        while (!records.empty()) {
+            auto space = records.find(' ');
+            auto length = size_t { 0 };
+            for (size_t i = 0; i < space && i < records.size() && records[i] >= '0' && records[i] <= '9'; i++)
+                length = length * 10 + static_cast<size_t>(records[i] - '0');
+            if (space == std::string_view::npos || length <= space + 1 || length > records.size() || records[length - 1] != '\n')
+                throw std::runtime_error { "TAR wrong PAX header of `" + entry.name + "`" };
+
+            auto record = records.substr(space + 1, length - space - 2);
+            records.remove_prefix(length);
+            auto equal = record.find('=');
+            if (equal == std::string_view::npos)
+                continue;
+            auto key = record.substr(0, equal), value = record.substr(equal + 1);
+            auto number = [](std::string_view value) {
+                auto result = int64_t { 0 };
+                auto negative = !value.empty() && value.front() == '-';
+                for (size_t i = negative ? 1 : 0; i < value.size() && value[i] >= '0' && value[i] <= '9'; i++) // fraction is dropped
+                    result = result * 10 + (value[i] - '0');
+                return negative ? -result : result;
+            };
+            if (key == "path")
+                fields.name = std::string { value };
+            else if (key == "linkpath")
+                fields.linkname = std::string { value };
+            else if (key == "size")
+                fields.size = static_cast<uint64_t>(number(value));
+            else if (key == "mtime")
+                fields.mtime = number(value);
+        }
+    }
+
+    auto apply(extension const& fields) -> void
+    {
+        if (fields.name)
+            entry.name = *fields.name;
+        if (fields.linkname)
+            entry.linkname = *fields.linkname;
+        if (fields.size)
+            entry.size = *fields.size;
+        if (fields.mtime)
+            entry.mtime = *fields.mtime;
+    }
+
+    selector select {};
+    visitor visit {};
+    std::array<uint8_t, 512> record {}; // header record
+    size_t record_size = 0; // collected part of header record
+    tar_entry entry {}; // current entry
+    bool selected = false; // data of current entry is passed to `visit`
+    char meta = 0; // type of extension record being read or zero
+    extension local {}; // extension of the next entry
+    extension global {}; // extension of all following entries
+    uint64_t remaining = 0; // data of current entry left to read
+    uint64_t padding = 0; // padding of current entry left to skip
+    uint64_t position = 0; // offset in TAR data
+    std::vector<uint8_t> buffer {}; // data of taken entry or extension record that spans chunks
+    bool ended = false; // end of archive record is read
+};
+
+///
+/// Walk all entries of TAR byte array in one pass, `visit` takes every entry
+/// in archive order with pointer to its data right inside TAR byte array
+///
+inline auto tar_for_each(std::vector<uint8_t> const& raw_tar, tar_stream::visitor visit) -> void
+{
+    tar_stream stream { [](tar_entry const&) { return true; }, std::move(visit) };
+    stream.push(raw_tar.data(), raw_tar.size());
+    stream.finish();
+}
+
+///
+/// Index of TAR byte array. All headers are read in one pass,
+/// then every lookup by name is one hash table search.
+/// TAR byte array must live as long as the index.
+///
+class tar_index {
+public:
+    explicit tar_index(std::vector<uint8_t> const& raw_tar)
+        : raw_tar { raw_tar }
+    {
+        tar_for_each(raw_tar, [this](tar_entry const& entry, uint8_t const*) { entries.push_back(entry); });
+
+        // names are in place now, so views of them stay valid;
+        // the last entry of a name wins, as extraction of TAR overwrites earlier ones
+        lookup.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); i++)
+            lookup.insert_or_assign(entries[i].name, i);
+    }
+
+    tar_index(tar_index const&) = delete;
+    auto operator=(tar_index const&) -> tar_index& = delete;
+
+    ///
+    /// Get all entries in archive order
+    ///
+    auto get_entries() const -> std::vector<tar_entry> const&
+    {
+        return entries;
+    }
+
+    ///
+    /// Find entry by full name, returns `nullptr` if not found
+    ///
+    auto find(std::string_view name) const -> tar_entry const*
+    {
+        auto found = lookup.find(name);
+        return (found != lookup.cend()) ? &entries[found->second] : nullptr;
+    }
+
+    ///
+    /// Get view of entry data right inside TAR byte array, without copying
+    ///
+    auto get_view(tar_entry const& entry) const -> std::string_view
+    {
+        return { reinterpret_cast<char const*>(raw_tar.data()) + entry.offset, static_cast<size_t>(entry.size) };
+    }
+
+    ///
+    /// Get view of file data right inside TAR byte array by full name
+    ///
+    auto get_view(std::string_view name) const -> std::string_view
+    {
+        auto entry = find(name);
+        if (entry == nullptr)
+            throw std::runtime_error { "Not found `" + std::string(name) + "` file in TAR" };
+        return get_view(*entry);
+    }
+
+private:
+    std::vector<uint8_t> const& raw_tar;
+    std::vector<tar_entry> entries {}; // in archive order
+    std::unordered_map<std::string_view, size_t> lookup {}; // name -> index of entry
+};
+
 } // namespace archive
@@ -0,0 +1,203 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "checksum.hpp"
+#include "curl.hpp"
+#include "storage.hpp"
+
+namespace cache {
+
+///
+/// Get path of file with validators of cached file
+///
+inline auto validators_path(std::filesystem::path path) -> std::filesystem::path
+{
+    return path += ".validators";
+}
+
+///
+/// Read validators (`ETag`, `Last-Modified`) kept next to cached file,
+/// they are empty if there is no cached copy
+///
+inline auto read_validators(std::filesystem::path const& path) -> curl::response
+{
+    auto result = curl::response {};
+    if (!std::filesystem::exists(path))
+        return result;
+
+    std::ifstream file { validators_path(path) };
+    for (std::string line {}; std::getline(file, line);)
+        curl::parse_header(line, result);
+    return result;
+}
+
+///
+/// Save validators next to cached file, as HTTP header lines
+///
+inline auto write_validators(std::filesystem::path const& path, curl::response const& validators) -> void
+{
+    auto text = std::string {};
+    if (!validators.etag.empty())
+        text += "ETag: " + validators.etag + '\n';
+    if (!validators.last_modified.empty())
+        text += "Last-Modified: " + validators.last_modified + '\n';
+    storage::write_file(validators_path(path), text.data(), text.size());
+}
+
+///
+/// Get name of cached file from its URL
+///
+inline auto file_name(std::string const& url) -> std::string
+{
+    return url.substr(url.rfind('/') + 1);
+}
+
+///
+/// Check that name is one component of path that stays in its directory
+/// (names of cached files come from database, which isn't signed)
+///
+inline auto is_file_name(std::string_view name) -> bool
+{
+    return !name.empty() && name.find_first_of("/\\") == std::string_view::npos && name.find("..") == std::string_view::npos;
+}
+
+///
+/// Check that `%SHA256SUM%` is 64 hexadecimal digits before it becomes a file name
+///
+inline auto is_sha256(std::string_view text) -> bool
+{
+    return text.size() == 64 && std::all_of(text.begin(), text.end(), [](char symbol) { return std::isxdigit(static_cast<unsigned char>(symbol)) != 0; });
+}
+
+///
+/// Receiver of a file ready to use, files are passed in order of their readiness.
+/// `transfer` is the response for the file, empty (status 0) if no request was made.
+/// Cached files are passed by a thread of their own, so it may be called by two threads at once
+///
+using ready_sink = std::function<void(size_t index, std::vector<uint8_t>&& data, curl::response const& transfer)>;
+
+///
+/// Download many files at the same time through cache in `dir` and pass every file
+/// to `ready` as soon as it is complete, while other files are still downloading.
+/// A file with known SHA-256 (`%SHA256SUM%` of package) is kept under its checksum and
+/// taken from disk without any request after verification, which runs while other files
+/// download; a downloaded one is hashed while it streams in.
+/// Other cached copies are revalidated with conditional requests, and an answer
+/// `304 Not Modified` is served from the cached copy without transfer.
+///
+inline auto get_files(curl::session& session, std::vector<std::string> const& urls, std::vector<std::string> const& sha256sums, std::filesystem::path const& dir, size_t max_parallel, ready_sink const& ready) -> void
+{
+    auto buffers = std::vector<std::vector<uint8_t>>(urls.size()); // data buffers
+    auto hashes = std::vector<checksum::sha256>(urls.size());
+    auto paths = std::vector<std::filesystem::path>(urls.size());
+    auto sums = sha256sums; // in lower case like `checksum::to_hex`
+    auto hits = std::vector<size_t> {}; // indexes of cached files to take by checksum
+    for (size_t i = 0; i < urls.size(); i++) {
+        auto& sha256 = sums[i];
+        if (!sha256.empty() && !is_sha256(sha256))
+            throw std::runtime_error("Not valid SHA-256 `" + sha256 + "` of `" + urls[i] + "`");
+        std::transform(sha256.begin(), sha256.end(), sha256.begin(), [](char symbol) { return static_cast<char>(std::tolower(static_cast<unsigned char>(symbol))); });
+        if (sha256.empty() && !is_file_name(file_name(urls[i])))
+            throw std::runtime_error("Not valid file name in `" + urls[i] + "`");
+        paths[i] = sha256.empty() ? dir / file_name(urls[i]) : dir / "sha256" / sha256;
+        if (!sha256.empty() && std::filesystem::exists(paths[i]))
+            hits.push_back(i);
+    }
+
+    auto requests = std::vector<curl::request> {};
+    auto add_request = [&](size_t i) {
+        if (sums[i].empty()) {
+            requests.push_back({ urls[i], curl::append_to(buffers[i]), read_validators(paths[i]), [&, i](curl::response const& info) {
+                                    if (info.status == 304) {
+                                        buffers[i] = storage::read_file(paths[i]);
+                                    } else {
+                                        storage::write_file(paths[i], buffers[i].data(), buffers[i].size());
+                                        write_validators(paths[i], info);
+                                    }
+                                    ready(i, std::move(buffers[i]), info);
+                                } });
+        } else {
+            auto write = [&buffer = buffers[i], &hash = hashes[i]](uint8_t const* data, size_t size) {
+                hash.update(data, size);
+                buffer.insert(buffer.end(), data, data + size);
+            };
+            requests.push_back({ urls[i], write, {}, [&, i](curl::response const& info) {
+                                    auto actual = checksum::to_hex(hashes[i].finish());
+                                    if (actual != sums[i])
+                                        throw std::runtime_error("SHA-256 of `" + urls[i] + "` is " + actual + ", expected " + sums[i]);
+                                    storage::write_file(paths[i], buffers[i].data(), buffers[i].size());
+                                    ready(i, std::move(buffers[i]), info);
+                                } });
+        }
+    };
+    for (size_t i = 0; i < urls.size(); i++)
+        if (!std::binary_search(hits.begin(), hits.end(), i))
+            add_request(i);
+
+    // files taken from disk are verified by groups that fill lanes of SHA-256 code while
+    // other files download: `ready` may wait for room and must not hold up transfers.
+    // A group is passed on before the next one is read, so memory of cached files is bounded.
+    // It is a thread, not a task of the executor: a waiting task could hold the last worker
+    auto stop = std::atomic<bool> { false };
+    auto failure = std::exception_ptr {};
+    auto damaged = std::vector<size_t> {}; // cached files to download again
+    std::thread verifier { [&]() {
+        constexpr size_t group_files = 8;
+        constexpr size_t group_bytes = 64 << 20;
+        try {
+            for (size_t first = 0; first < hits.size() && !stop;) {
+                auto group = std::vector<size_t> {};
+                auto messages = std::vector<checksum::message> {};
+                auto bytes = size_t { 0 };
+                for (; first < hits.size() && group.size() < group_files && bytes < group_bytes; first++) {
+                    auto i = hits[first];
+                    buffers[i] = storage::read_file(paths[i]);
+                    bytes += buffers[i].size();
+                    group.push_back(i);
+                    messages.push_back({ buffers[i].data(), buffers[i].size() });
+                }
+                auto digests = checksum::sha256_many(messages);
+                for (size_t j = 0; j < group.size(); j++) {
+                    auto i = group[j];
+                    if (checksum::to_hex(digests[j]) == sums[i]) {
+                        ready(i, std::move(buffers[i]), {});
+                    } else {
+                        buffers[i] = {};
+                        damaged.push_back(i);
+                    }
+                }
+            }
+        } catch (...) {
+            failure = std::current_exception();
+        }
+    } };
+    try {
+        session.get_files(requests, max_parallel);
+    } catch (...) {
+        stop = true;
+        verifier.join();
+        throw;
+    }
+    verifier.join();
+    if (failure)
+        std::rethrow_exception(failure);
+
+    // damaged copies are downloaded again
+    requests.clear();
+    for (auto i : damaged)
+        add_request(i);
+    session.get_files(requests, max_parallel);
+}
+
+} // namespace cache
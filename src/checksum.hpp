@@ -0,0 +1,128 @@
+#pragma once
+#include <Sha256.h>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "workers.hpp"
+
+namespace checksum {
+
+///
+/// Select SHA-256 code for this CPU once
+///
+inline auto prepare() -> void
+{
+    static auto const prepared = (Sha256Prepare(), true);
+    (void)prepared;
+}
+
+///
+/// Incremental SHA-256 of data passed chunk by chunk
+///
+class sha256 {
+public:
+    using digest = std::array<uint8_t, SHA256_DIGEST_SIZE>;
+
+    sha256()
+    {
+        prepare();
+        Sha256_Init(&state);
+    }
+
+    auto update(uint8_t const* data, size_t size) -> void { Sha256_Update(&state, data, size); }
+
+    auto finish() -> digest
+    {
+        auto result = digest {};
+        Sha256_Final(&state, result.data());
+        return result;
+    }
+
+private:
+    CSha256 state {};
+};
+
+///
+/// Message to hash
+///
+struct message {
+    uint8_t const* data;
+    size_t size;
+};
+
+///
+/// SHA-256 of many messages, with AVX2 they are hashed 8 at once.
+/// Messages are grouped by size, common blocks of a group go through
+/// all lanes together and the rest of every message is hashed alone.
+/// Groups (single messages without AVX2) are hashed by tasks of the shared executor.
+///
+inline auto sha256_many(std::vector<message> const& messages) -> std::vector<sha256::digest>
+{
+    prepare();
+    auto result = std::vector<sha256::digest>(messages.size());
+    auto hash = [&](size_t i, CSha256& state, size_t done) {
+        Sha256_Update(&state, messages[i].data + done, messages[i].size - done);
+        Sha256_Final(&state, result[i].data());
+    };
+    workers::task_group tasks { workers::shared_executor() };
+    if (!Sha256_IsSupported_Lanes() || messages.size() < 2) {
+        for (size_t i = 0; i < messages.size(); i++)
+            tasks.run([&hash, i]() {
+                auto state = CSha256 {};
+                Sha256_Init(&state);
+                hash(i, state, 0);
+            });
+        tasks.wait();
+        return result;
+    }
+
+    auto order = std::vector<size_t>(messages.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return messages[a].size > messages[b].size; });
+
+    for (size_t first = 0; first < order.size(); first += SHA256_NUM_LANES)
+        tasks.run([&, first]() {
+            auto count = std::min<size_t>(order.size() - first, SHA256_NUM_LANES);
+            auto blocks = messages[order[first + count - 1]].size / 64; // common for all lanes
+            auto initial = CSha256 {};
+            Sha256_Init(&initial);
+
+            UInt32 states[SHA256_NUM_LANES][8];
+            Byte const* data[SHA256_NUM_LANES];
+            for (size_t lane = 0; lane < SHA256_NUM_LANES; lane++) {
+                std::copy(std::begin(initial.state), std::end(initial.state), states[lane]);
+                data[lane] = messages[order[first + (lane < count ? lane : 0)]].data; // free lanes repeat the first one
+            }
+            Sha256_UpdateLanes(states, data, blocks);
+
+            for (size_t lane = 0; lane < count; lane++) {
+                auto state = initial;
+                std::copy(std::begin(states[lane]), std::end(states[lane]), state.state);
+                state.count = blocks * 64;
+                hash(order[first + lane], state, blocks * 64);
+            }
+        });
+    tasks.wait();
+    return result;
+}
+
+///
+/// Convert digest to lowercase hexadecimal string (the form of `%SHA256SUM%`)
+///
+inline auto to_hex(sha256::digest const& digest) -> std::string
+{
+    constexpr auto digits = std::string_view { "0123456789abcdef" };
+    auto result = std::string {};
+    for (auto byte : digest) {
+        result += digits[byte >> 4];
+        result += digits[byte & 0xF];
+    }
+    return result;
+}
+
+} // namespace checksum
@@ -1,8 +1,17 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
 #include <curl/curl.h>
+#include <exception>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace curl {
@@ -16,36 +25,359 @@ inline auto get_version() -> std::string
 }
 
 ///
-/// Download any file from the Internet
+/// Receiver of downloaded data, gets every chunk as soon as it arrives
 ///
-inline auto get_file(std::string const& url) -> std::vector<uint8_t>
+using sink = std::function<void(uint8_t const* data, size_t size)>;
+
+///
+/// Phases of transfer: seconds from its start till the end of every phase, and its size
+///
+struct timing {
+    double name_lookup = 0; // DNS
+    double connect = 0; // TCP connection, 0 for a reused one
+    double tls = 0; // TLS handshake, 0 for plain HTTP or a reused connection
+    double first_byte = 0; // the first byte of response
+    double total = 0; // the whole transfer
+    uint64_t bytes = 0; // downloaded bytes
+    std::chrono::steady_clock::time_point end {}; // when the transfer ended, so parallel ones can be put on one time line
+};
+
+///
+/// Response of HTTP server
+///
+struct response {
+    long status = 0; // HTTP status code
+    std::string etag {}; // `ETag` header
+    std::string last_modified {}; // `Last-Modified` header
+    timing times {}; // phases of transfer
+};
+
+///
+/// Downloaded data receiver with place for an error thrown from it
+///
+struct receiver {
+    sink write {};
+    std::exception_ptr error {}; // exception can't pass through `curl` code
+    response info {};
+};
+
+///
+/// Request of file download
+///
+struct request {
+    std::string url {};
+    sink write {}; // receiver of data
+    response validators {}; // `ETag` and `Last-Modified` of a cached copy for conditional request
+    std::function<void(response const& info)> done {}; // called as soon as this transfer is complete
+};
+
+///
+/// Make headers of conditional request, a server answers `304 Not Modified`
+/// if the file still matches validators
+///
+inline auto make_conditional_headers(response const& validators) -> std::shared_ptr<curl_slist>
+{
+    curl_slist* headers = nullptr;
+    if (!validators.etag.empty())
+        headers = curl_slist_append(headers, ("If-None-Match: " + validators.etag).c_str());
+    if (!validators.last_modified.empty())
+        headers = curl_slist_append(headers, ("If-Modified-Since: " + validators.last_modified).c_str());
+    return { headers, curl_slist_free_all };
+}
+
+///
+/// Take `ETag` and `Last-Modified` values from HTTP header line
+///
+inline auto parse_header(std::string_view line, response& info) -> void
 {
-    std::shared_ptr<CURL> curl { curl_easy_init(), curl_easy_cleanup };
-    if (curl.get() == nullptr)
-        throw std::runtime_error("Not make `curl` object");
+    if (line.substr(0, 5) == "HTTP/") {
+        info = {}; // next response after redirect
+        return;
+    }
 
-    curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str()); // download page URL
-    curl_easy_setopt(curl.get(), CURLOPT_SSL_VERIFYPEER, false);
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos)
+        return;
+    auto name = line.substr(0, colon);
+    auto value = line.substr(colon + 1);
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+        value.remove_prefix(1);
+    while (!value.empty() && (value.back() == '\r' || value.back() == '\n' || value.back() == ' '))
+        value.remove_suffix(1);
 
-    std::string error_str {}; // error string buffer
-    error_str.reserve(CURL_ERROR_SIZE);
-    curl_easy_setopt(curl.get(), CURLOPT_ERRORBUFFER, error_str.data());
+    auto is = [name](std::string_view expected) {
+        return name.size() == expected.size() && std::equal(name.begin(), name.end(), expected.begin(), [](char a, char b) {
+            return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+        });
+    };
+    if (is("ETag"))
+        info.etag = value;
+    else if (is("Last-Modified"))
+        info.last_modified = value;
+}
+
+///
+/// Set common options of `curl` object: URL, error buffer and data receiver
+///
+inline auto setup(CURL* curl, std::string const& url, char* error_buffer, receiver& output) -> void
+{
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str()); // download page URL
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L); // HTTP errors aren't data
+    curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buffer);
 
-    std::vector<uint8_t> buffer {}; // data buffer
     auto write_callback = [](void* ptr, size_t size, size_t nmemb, void* userdata) -> size_t {
-        std::vector<uint8_t>& buffer = *static_cast<std::vector<uint8_t>*>(userdata);
+        receiver& output = *static_cast<receiver*>(userdata);
         auto realsize = size * nmemb;
-        buffer.insert(buffer.end(), reinterpret_cast<uint8_t const*>(ptr), reinterpret_cast<uint8_t const*>(ptr) + realsize);
+        try {
+            output.write(reinterpret_cast<uint8_t const*>(ptr), realsize);
+        } catch (...) {
+            output.error = std::current_exception();
+            return 0; // abort transfer
+        }
         return realsize;
     };
-    curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, static_cast<size_t (*)(void*, size_t, size_t, void*)>(write_callback));
-    curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, static_cast<size_t (*)(void*, size_t, size_t, void*)>(write_callback));
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &output);
 
-    auto result = curl_easy_perform(curl.get()); // get file
-    if (result != CURLE_OK)
-        throw std::runtime_error(curl_easy_strerror(result));
+    auto header_callback = [](char* ptr, size_t size, size_t nmemb, void* userdata) -> size_t {
+        parse_header({ ptr, size * nmemb }, static_cast<receiver*>(userdata)->info);
+        return size * nmemb;
+    };
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, static_cast<size_t (*)(char*, size_t, size_t, void*)>(header_callback));
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &output);
+}
 
-    return buffer;
+///
+/// Read status and phases of complete transfer
+///
+inline auto read_info(CURL* curl, response& info) -> void
+{
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &info.status);
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &info.times.name_lookup);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &info.times.connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &info.times.tls);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &info.times.first_byte);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &info.times.total);
+    auto bytes = curl_off_t { 0 };
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    info.times.bytes = static_cast<uint64_t>(bytes);
+    info.times.end = std::chrono::steady_clock::now();
+}
+
+///
+/// Receiver which appends data to byte array
+///
+inline auto append_to(std::vector<uint8_t>& buffer) -> sink
+{
+    return [&buffer](uint8_t const* data, size_t size) { buffer.insert(buffer.end(), data, data + size); };
+}
+
+///
+/// Long-lived download session. Keeps a pool of `curl` objects and shares DNS,
+/// connection and SSL session caches between them, so repeated downloads from
+/// the same mirror reuse warm connections.
+///
+class session {
+public:
+    session()
+    {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+
+        share = { curl_share_init(), curl_share_cleanup };
+        if (share.get() == nullptr)
+            throw std::runtime_error("Not make `curl share` object");
+
+        auto lock_callback = [](CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+            static_cast<session*>(userptr)->locks[data].lock();
+        };
+        auto unlock_callback = [](CURL*, curl_lock_data data, void* userptr) {
+            static_cast<session*>(userptr)->locks[data].unlock();
+        };
+        curl_share_setopt(share.get(), CURLSHOPT_LOCKFUNC, static_cast<void (*)(CURL*, curl_lock_data, curl_lock_access, void*)>(lock_callback));
+        curl_share_setopt(share.get(), CURLSHOPT_UNLOCKFUNC, static_cast<void (*)(CURL*, curl_lock_data, void*)>(unlock_callback));
+        curl_share_setopt(share.get(), CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+        multi = { curl_multi_init(), curl_multi_cleanup };
+        if (multi.get() == nullptr)
+            throw std::runtime_error("Not make `curl multi` object");
+    }
+
+    ~session()
+    {
+        for (auto curl : pool)
+            curl_easy_cleanup(curl);
+        multi.reset();
+        share.reset();
+        curl_global_cleanup();
+    }
+
+    session(session const&) = delete;
+    auto operator=(session const&) -> session& = delete;
+
+    ///
+    /// Download any file from the Internet
+    ///
+    auto get_file(std::string const& url) -> std::vector<uint8_t>
+    {
+        std::vector<uint8_t> buffer {}; // data buffer
+        get_file(url, append_to(buffer));
+        return buffer;
+    }
+
+    ///
+    /// Download any file from the Internet and pass its data to `write` chunk by chunk.
+    /// With `validators` of a cached copy the request is conditional and the response
+    /// has status 304 and no data if the copy is still valid.
+    ///
+    auto get_file(std::string const& url, sink write, response const& validators = {}) -> response
+    {
+        auto curl = acquire();
+        std::array<char, CURL_ERROR_SIZE> error_str {}; // error string buffer
+        receiver output { std::move(write) };
+        setup(curl.get(), url, error_str.data(), output);
+        auto headers = make_conditional_headers(validators);
+        curl_easy_setopt(curl.get(), CURLOPT_HTTPHEADER, headers.get());
+
+        auto result = curl_easy_perform(curl.get()); // get file
+        if (output.error)
+            std::rethrow_exception(output.error);
+        if (result != CURLE_OK)
+            throw std::runtime_error(curl_easy_strerror(result));
+
+        read_info(curl.get(), output.info);
+        return output.info;
+    }
+
+    ///
+    /// Download many files from the Internet at the same time,
+    /// no more than `max_parallel` transfers are running at once
+    ///
+    auto get_files(std::vector<request> const& requests, size_t max_parallel = 8) -> std::vector<response>
+    {
+        struct transfer {
+            std::shared_ptr<CURL> curl {}; // active `curl` object
+            std::shared_ptr<curl_slist> headers {}; // headers of conditional request
+            std::array<char, CURL_ERROR_SIZE> error_str {}; // error string buffer
+            receiver output {};
+        };
+        auto transfers = std::vector<transfer>(requests.size());
+        auto responses = std::vector<response>(requests.size());
+
+        size_t next = 0; // index of next request to start
+        size_t running = 0; // number of active transfers
+        auto start_next = [&]() {
+            auto& current = transfers[next];
+            current.curl = acquire();
+            current.output.write = requests[next].write;
+            setup(current.curl.get(), requests[next].url, current.error_str.data(), current.output);
+            current.headers = make_conditional_headers(requests[next].validators);
+            curl_easy_setopt(current.curl.get(), CURLOPT_HTTPHEADER, current.headers.get());
+            curl_easy_setopt(current.curl.get(), CURLOPT_PRIVATE, reinterpret_cast<char*>(next));
+            curl_multi_add_handle(multi.get(), current.curl.get());
+            next++;
+            running++;
+        };
+
+        // detach all active transfers from `curl multi` object on exit or error
+        auto detach = [this](std::vector<transfer>* transfers) {
+            for (auto& current : *transfers)
+                if (current.curl)
+                    curl_multi_remove_handle(multi.get(), current.curl.get());
+        };
+        std::unique_ptr<std::vector<transfer>, decltype(detach)> guard { &transfers, detach };
+
+        while (next < requests.size() && running < std::max<size_t>(max_parallel, 1))
+            start_next();
+
+        while (running > 0) {
+            auto still_running = 0;
+            auto result = curl_multi_perform(multi.get(), &still_running);
+            if (result != CURLM_OK)
+                throw std::runtime_error(curl_multi_strerror(result));
+
+            auto messages = 0;
+            while (auto message = curl_multi_info_read(multi.get(), &messages)) {
+                if (message->msg != CURLMSG_DONE)
+                    continue;
+
+                char* index_ptr = nullptr;
+                curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &index_ptr);
+                auto index = reinterpret_cast<size_t>(index_ptr);
+                auto& current = transfers[index];
+                if (current.output.error)
+                    std::rethrow_exception(current.output.error);
+                if (message->data.result != CURLE_OK)
+                    throw std::runtime_error(requests[index].url + ": " + curl_easy_strerror(message->data.result));
+
+                read_info(message->easy_handle, current.output.info);
+                responses[index] = current.output.info;
+                curl_multi_remove_handle(multi.get(), message->easy_handle);
+                current.curl.reset();
+                running--;
+                if (next < requests.size())
+                    start_next();
+                if (requests[index].done)
+                    requests[index].done(responses[index]); // other transfers go on meanwhile
+            }
+
+            if (running > 0)
+                curl_multi_poll(multi.get(), nullptr, 0, 1000, nullptr);
+        }
+
+        return responses;
+    }
+
+private:
+    ///
+    /// Take `curl` object from pool (or make new one), it returns to pool on release
+    ///
+    auto acquire() -> std::shared_ptr<CURL>
+    {
+        std::lock_guard<std::mutex> lock { pool_lock };
+        CURL* curl = nullptr;
+        if (pool.empty()) {
+            curl = curl_easy_init();
+            if (curl == nullptr)
+                throw std::runtime_error("Not make `curl` object");
+        } else {
+            curl = pool.back();
+            pool.pop_back();
+        }
+
+        return { curl, [this](CURL* curl) {
+                    curl_easy_reset(curl); // keeps connections, DNS and SSL session caches
+                    std::lock_guard<std::mutex> lock { pool_lock };
+                    pool.push_back(curl);
+                } };
+    }
+
+    ///
+    /// Options of every `curl` object taken from pool
+    ///
+    auto setup(CURL* curl, std::string const& url, char* error_buffer, receiver& output) -> void
+    {
+        curl::setup(curl, url, error_buffer, output);
+        curl_easy_setopt(curl, CURLOPT_SHARE, share.get());
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    }
+
+    std::shared_ptr<CURLSH> share {}; // shared DNS, connection and SSL session caches
+    std::shared_ptr<CURLM> multi {}; // for parallel transfers
+    std::vector<CURL*> pool {}; // free `curl` objects
+    std::mutex pool_lock {};
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> locks {}; // locks of shared data
+};
+
+///
+/// Download any file from the Internet
+///
+inline auto get_file(std::string const& url) -> std::vector<uint8_t>
+{
+    return session {}.get_file(url);
 }
 
 } // namespace curl
@@ -0,0 +1,583 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "archive.hpp"
+#include "storage.hpp"
+#include "uring.hpp"
+#include "workers.hpp"
+
+namespace extract {
+
+///
+/// Match name with glob pattern: `*` is any part of one path component, `?` is any symbol
+///
+inline auto glob_match(std::string_view pattern, std::string_view name) -> bool
+{
+    size_t p = 0, n = 0; // positions in `pattern` and `name`
+    auto star = std::string_view::npos, star_name = size_t { 0 }; // last `*` and name position for it
+    while (n < name.size()) {
+        if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            star_name = n;
+        } else if (p < pattern.size() && (pattern[p] == name[n] || (pattern[p] == '?' && name[n] != '/'))) {
+            p++;
+            n++;
+        } else if (star != std::string_view::npos && name[star_name] != '/') {
+            p = star + 1; // `*` takes one more symbol
+            n = ++star_name;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+///
+/// File list of package compiled for matching of TAR entries. The list is separated
+/// by commas, spaces or `|`, every item is a pattern of the last path components:
+/// `msys-2.0.dll` is a file anywhere, `etc/fstab` is a file in `etc`, `tmp/` and `bin`
+/// are directories with all their content, `msys-gcc_s-seh-*.dll` is a glob.
+/// Item `a -> b` also places matched `a` to path `b` (content of directory `a` goes to `b`).
+/// Empty list takes the whole package except pacman metadata.
+///
+class matcher {
+public:
+    ///
+    /// Output path of matched entry and item of list that took it
+    ///
+    struct target {
+        std::string path;
+        size_t rule;
+    };
+
+    explicit matcher(std::string_view list)
+    {
+        auto trim = [](std::string_view value) {
+            auto first = value.find_first_not_of(" \t");
+            if (first == std::string_view::npos)
+                return std::string_view {};
+            return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+        };
+
+        while (!list.empty()) {
+            auto end = std::min(list.find_first_of(",|"), list.size());
+            auto item = list.substr(0, end);
+            list.remove_prefix(std::min(end + 1, list.size()));
+
+            if (auto arrow = item.find("->"); arrow != std::string_view::npos) {
+                auto source = trim(item.substr(0, arrow)), path = trim(item.substr(arrow + 2));
+                if (source.empty() || path.empty())
+                    throw std::runtime_error { "Wrong link `" + std::string(item) + "` in file list" };
+                add_rule(source, path);
+                continue;
+            }
+            for (size_t first = 0; first < item.size();) {
+                auto last = std::min(item.find_first_of(" \t", first), item.size());
+                if (last > first)
+                    add_rule(item.substr(first, last - first), {});
+                first = last + 1;
+            }
+        }
+
+        // rules are in place now, so views of their patterns stay valid
+        for (size_t i = 0; i < rules.size(); i++)
+            if (!rules[i].glob)
+                literals[rules[i].pattern].push_back(i);
+    }
+
+    matcher(matcher const&) = delete;
+    auto operator=(matcher const&) -> matcher& = delete;
+
+    ///
+    /// Check that list takes the whole package
+    ///
+    auto whole() const -> bool { return rules.empty(); }
+
+    ///
+    /// Get item of list as it was written
+    ///
+    auto get_rule(size_t rule) const -> std::string
+    {
+        auto const& item = rules[rule];
+        return item.pattern + (item.directory ? "/" : "") + (item.link.empty() ? "" : " -> " + item.link);
+    }
+
+    auto get_rule_count() const -> size_t { return rules.size(); }
+
+    ///
+    /// Get output paths of TAR entry, empty if entry isn't taken. Every run of path
+    /// components of entry name is compared with patterns of the same length:
+    /// literals by one hash table search, globs one by one.
+    ///
+    auto match(std::string_view name, bool directory) const -> std::vector<target>
+    {
+        auto result = std::vector<target> {};
+        if (name.substr(0, 2) == "./")
+            name.remove_prefix(2);
+        if (!name.empty() && name.back() == '/') {
+            name.remove_suffix(1);
+            directory = true;
+        }
+        if (name.empty())
+            return result;
+        if (whole()) {
+            if (name.front() != '.' || name.find('/') != std::string_view::npos) // `.PKGINFO`, `.MTREE` etc.
+                result.push_back({ std::string { name }, 0 });
+            return result;
+        }
+
+        // start of every path component
+        auto starts = std::vector<size_t> { 0 };
+        for (size_t i = 0; i < name.size(); i++)
+            if (name[i] == '/')
+                starts.push_back(i + 1);
+
+        auto add = [&](size_t rule, size_t end) {
+            auto const& item = rules[rule];
+            if (item.directory && end == name.size() && !directory)
+                return; // pattern of directory matches a file
+            auto path = item.link.empty() ? std::string { name } : item.link + std::string { name.substr(end) };
+            for (auto const& taken : result)
+                if (taken.path == path)
+                    return;
+            result.push_back({ std::move(path), rule });
+        };
+
+        for (size_t last = 0; last < starts.size(); last++) {
+            auto end = (last + 1 < starts.size()) ? starts[last + 1] - 1 : name.size();
+            for (size_t first = 0; first <= last; first++) {
+                auto window = name.substr(starts[first], end - starts[first]);
+                if (auto found = literals.find(window); found != literals.cend())
+                    for (auto rule : found->second)
+                        add(rule, end);
+                for (auto rule : globs)
+                    if (rules[rule].components == last - first + 1 && glob_match(rules[rule].pattern, window))
+                        add(rule, end);
+            }
+        }
+        return result;
+    }
+
+private:
+    struct rule {
+        std::string pattern; // path components without trailing `/`
+        std::string link; // output path of link or empty
+        size_t components; // number of path components in pattern
+        bool directory; // pattern ends with `/`
+        bool glob; // pattern has `*` or `?`
+    };
+
+    auto add_rule(std::string_view pattern, std::string_view link) -> void
+    {
+        if (pattern.substr(0, 2) == "./")
+            pattern.remove_prefix(2);
+        while (!pattern.empty() && pattern.front() == '/')
+            pattern.remove_prefix(1);
+        auto directory = !pattern.empty() && pattern.back() == '/';
+        while (!pattern.empty() && pattern.back() == '/')
+            pattern.remove_suffix(1);
+        if (pattern.empty())
+            throw std::runtime_error("Empty pattern in file list");
+        while (!link.empty() && link.back() == '/')
+            link.remove_suffix(1);
+
+        auto item = rule { std::string { pattern }, std::string { link }, 1, directory, pattern.find_first_of("*?") != std::string_view::npos };
+        item.components += std::count(pattern.begin(), pattern.end(), '/');
+        if (item.glob)
+            globs.push_back(rules.size());
+        rules.push_back(std::move(item));
+    }
+
+    std::vector<rule> rules {}; // in list order
+    std::vector<size_t> globs {}; // indexes of glob rules
+    std::unordered_map<std::string_view, std::vector<size_t>> literals {}; // pattern -> indexes of rules
+};
+
+///
+/// Writer of extracted files under `root`. Files are written by tasks of `pool`,
+/// data of files in flight is limited by `max_bytes`. With `batched` writes on Linux
+/// a task writes a batch of files by one io_uring submission, so thousands of
+/// small files don't cost three system calls each. Without io_uring support
+/// every file is a separate task. Directories are made by caller thread at once, each
+/// directory once. Links, permissions and times are applied in a batch by `finish`:
+/// after all files are in place, so a read-only directory never blocks writes, times of
+/// directories aren't changed by their content and nothing is written through a symbolic link.
+/// Entry names must stay under `root`: an absolute name or a `..` component is an error.
+/// Entries may be added from many threads at once.
+///
+class writer {
+public:
+    writer(std::filesystem::path root, workers::executor& pool, bool batched = true, size_t max_bytes = 64 << 20)
+        : root { std::move(root) }
+        , writes { pool, max_bytes }
+        , batched { batched && uring::is_supported() }
+    {
+    }
+
+    ///
+    /// Check that files are written by io_uring batches
+    ///
+    auto is_batched() const -> bool { return batched; }
+
+    writer(writer const&) = delete;
+    auto operator=(writer const&) -> writer& = delete;
+
+    auto get_root() const -> std::filesystem::path const& { return root; }
+
+    ///
+    /// Time of write tasks summed over them and size of written files
+    ///
+    auto get_write_seconds() const -> double { return static_cast<double>(write_time) / 1e9; }
+    auto get_written_bytes() const -> uint64_t { return written_bytes; }
+
+    auto add_directory(std::string const& name, uint32_t mode, int64_t mtime) -> void
+    {
+        auto path = make_path(name);
+        std::lock_guard<std::mutex> lock { writer_lock };
+        make_directories(path);
+        symlinks.erase(path.native());
+        metas.push_back({ std::move(path), mode, mtime, true });
+    }
+
+    ///
+    /// Copy data and queue file write, waits while too much data is in flight
+    ///
+    auto add_file(std::string const& name, uint8_t const* data, size_t size, uint32_t mode, int64_t mtime) -> void
+    {
+        auto path = make_path(name);
+        std::unique_lock<std::mutex> lock { writer_lock };
+        make_directories(path.parent_path());
+        symlinks.erase(path.native());
+        if (!planned.insert(path.native()).second) {
+            // the same file is written again, the first write must end before
+            auto files = take_batch();
+            lock.unlock();
+            flush(std::move(files));
+            writes.wait();
+            lock.lock();
+        }
+        metas.push_back({ path, mode, mtime, false });
+        if (batched) {
+            batch.files.push_back({ std::move(path), std::vector<uint8_t>(data, data + size) });
+            batch.bytes += size + 4096; // a file costs a page at least
+            if (batch.files.size() < uring::batch_files && batch.bytes < max_batch_bytes)
+                return;
+            auto files = take_batch();
+            lock.unlock();
+            flush(std::move(files));
+            return;
+        }
+        lock.unlock();
+        auto content = std::make_shared<std::vector<uint8_t>>(data, data + size);
+        writes.run([this, path = std::move(path), content]() { measure(content->size(), [&]() { storage::put_file(path, content->data(), content->size()); }); }, size + 4096);
+    }
+
+    ///
+    /// Queue symbolic link, it is made by `finish`
+    ///
+    auto add_symlink(std::string const& name, std::string const& target) -> void
+    {
+        auto path = make_path(name);
+        std::lock_guard<std::mutex> lock { writer_lock };
+        make_directories(path.parent_path());
+        symlinks.insert_or_assign(path.native(), std::make_pair(path, std::filesystem::u8path(target)));
+    }
+
+    ///
+    /// Queue copy of file written before, it is made by `finish`
+    ///
+    auto add_hard_link(std::string const& name, std::string const& source, uint32_t mode, int64_t mtime) -> void
+    {
+        auto path = make_path(name);
+        auto from = make_path(source);
+        std::lock_guard<std::mutex> lock { writer_lock };
+        make_directories(path.parent_path());
+        symlinks.erase(path.native());
+        links.emplace_back(std::move(from), path);
+        metas.push_back({ std::move(path), mode, mtime, false });
+    }
+
+    ///
+    /// Wait for all files, then make links and apply permissions and times.
+    /// No entries are added meanwhile
+    ///
+    auto finish() -> void
+    {
+        flush(take_batch());
+        writes.wait();
+        for (auto const& [source, path] : links)
+            writes.run([source = source, path = path]() {
+                if (source == path)
+                    return;
+                std::filesystem::remove(path); // a symbolic link of an earlier run is replaced, not written through
+                std::filesystem::copy_file(source, path);
+            });
+        writes.wait();
+
+        // files first, then directories from the deepest one
+        std::stable_partition(metas.begin(), metas.end(), [](meta const& item) { return !item.directory; });
+        auto directories = std::find_if(metas.begin(), metas.end(), [](meta const& item) { return item.directory; });
+        std::stable_sort(directories, metas.end(), [](meta const& one, meta const& two) { return one.path.native().size() > two.path.native().size(); });
+        for (auto item = metas.begin(); item != directories; item++)
+            writes.run([item]() { storage::set_file_meta(item->path, item->mode | 0200, item->mtime); }); // owner can rewrite it by next runs
+        writes.wait();
+
+        // symbolic links from the deepest one, so none of them is made through another
+        auto ordered = std::vector<std::pair<std::filesystem::path, std::filesystem::path>> {};
+        for (auto const& [key, item] : symlinks)
+            ordered.push_back(item);
+        std::sort(ordered.begin(), ordered.end(), [](auto const& one, auto const& two) { return one.first.native().size() > two.first.native().size(); });
+        for (auto const& [path, target] : ordered) {
+            auto failed = std::error_code {};
+            std::filesystem::remove(path, failed);
+            if (failed)
+                throw std::runtime_error { "Not replace `" + path.string() + "` by symbolic link: " + failed.message() };
+            made.erase(path.native());
+            std::filesystem::create_symlink(target, path);
+        }
+
+        for (auto item = directories; item != metas.end(); item++)
+            if (symlinks.count(item->path.native()) == 0)
+                storage::set_file_meta(item->path, item->mode | 0700, item->mtime); // owner keeps access for next runs
+
+        links.clear();
+        symlinks.clear();
+        metas.clear();
+        planned.clear();
+    }
+
+private:
+    struct meta {
+        std::filesystem::path path;
+        uint32_t mode;
+        int64_t mtime;
+        bool directory;
+    };
+
+    struct pending {
+        std::filesystem::path path;
+        std::vector<uint8_t> content;
+    };
+
+    struct pending_batch {
+        std::vector<pending> files {};
+        size_t bytes = 0; // weight of batch in `writes`
+    };
+
+    static constexpr size_t max_batch_bytes = 8 << 20; // data of one io_uring batch
+
+    ///
+    /// Take collected batch of files, under lock
+    ///
+    auto take_batch() -> pending_batch
+    {
+        return std::exchange(batch, {});
+    }
+
+    ///
+    /// Queue batch of files, waits while too much data is in flight
+    ///
+    auto flush(pending_batch&& files) -> void
+    {
+        if (files.files.empty())
+            return;
+        auto weight = files.bytes;
+        auto content = std::make_shared<std::vector<pending>>(std::move(files.files));
+        writes.run(
+            [this, content]() {
+                auto list = std::vector<uring::file> {};
+                auto bytes = size_t { 0 };
+                for (auto const& item : *content) {
+                    list.push_back({ item.path, item.content.data(), item.content.size() });
+                    bytes += item.content.size();
+                }
+                measure(bytes, [&]() { uring::write_files(list); });
+            },
+            weight);
+    }
+
+    ///
+    /// Run write of `bytes` and count its time
+    ///
+    template <typename action>
+    auto measure(size_t bytes, action&& write) -> void
+    {
+        auto start = std::chrono::steady_clock::now();
+        write();
+        write_time += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        written_bytes += bytes;
+    }
+
+    ///
+    /// Output path of entry: `.` and empty components are dropped, a path out of `root` is an error
+    ///
+    auto make_path(std::string const& name) const -> std::filesystem::path
+    {
+        auto relative = std::filesystem::u8path(name).lexically_normal();
+        auto inside = !relative.has_root_path();
+        for (auto const& part : relative)
+            inside = inside && part != "..";
+        if (!inside)
+            throw std::runtime_error { "Not extract `" + name + "`: path is out of output directory" };
+        return root / relative;
+    }
+
+    ///
+    /// Make directory under `root` with its parents, each one once. A symbolic link on the way,
+    /// left by an earlier run for example, is an error: nothing is written through it
+    ///
+    auto make_directories(std::filesystem::path const& path) -> void
+    {
+        if (made.count(path.native()) != 0)
+            return;
+        if (made.insert(root.native()).second)
+            std::filesystem::create_directories(root);
+        auto current = root;
+        for (auto const& part : path.lexically_relative(root)) {
+            current /= part;
+            if (made.count(current.native()) != 0)
+                continue;
+            auto status = std::filesystem::symlink_status(current);
+            if (std::filesystem::is_symlink(status))
+                throw std::runtime_error { "Not write to `" + path.string() + "`: `" + current.string() + "` is a symbolic link" };
+            if (!std::filesystem::is_directory(status))
+                std::filesystem::create_directory(current);
+            made.insert(current.native());
+        }
+    }
+
+    std::filesystem::path root;
+    std::atomic<uint64_t> write_time { 0 }; // nanoseconds of write tasks
+    std::atomic<uint64_t> written_bytes { 0 };
+    workers::task_group writes; // writes of files, they count time and bytes above
+    bool batched; // files are written by io_uring
+    std::mutex writer_lock {}; // guards everything below
+    pending_batch batch {}; // files of next io_uring batch
+    std::unordered_set<std::filesystem::path::string_type> made {}; // directories already made
+    std::unordered_set<std::filesystem::path::string_type> planned {}; // files already queued
+    std::vector<std::pair<std::filesystem::path, std::filesystem::path>> links {}; // hard links: source, path
+    std::unordered_map<std::filesystem::path::string_type, std::pair<std::filesystem::path, std::filesystem::path>> symlinks {}; // path -> path, target
+    std::vector<meta> metas {}; // permissions and times to apply
+};
+
+///
+/// Result of extraction
+///
+struct summary {
+    uint64_t unpacked = 0; // size of TAR data
+    size_t files = 0; // number of written files
+    uint64_t bytes = 0; // size of written files
+    std::vector<std::string> missing {}; // items of list that matched nothing
+    std::vector<std::string> unlinked {}; // hard links skipped as their target isn't taken: `name -> target`
+};
+
+///
+/// Taker of entries of one package: TAR data pushed chunk by chunk is parsed on the fly,
+/// entries taken by `files` go to `output`. Hard links are copied from their earlier entry,
+/// a hard link to an entry that isn't taken is skipped and reported in summary.
+///
+class package_stream {
+public:
+    package_stream(matcher const& files, writer& output)
+        : files { files }
+        , output { output }
+        , used(files.get_rule_count())
+        , tar { [this](archive::tar_entry const& entry) { return select(entry); },
+            [this](archive::tar_entry const& entry, uint8_t const* data) { write(entry, data); } }
+    {
+    }
+
+    package_stream(package_stream const&) = delete;
+    auto operator=(package_stream const&) -> package_stream& = delete;
+
+    ///
+    /// Parse next chunk of TAR data
+    ///
+    auto push(uint8_t const* data, size_t size) -> void
+    {
+        result.unpacked += size;
+        tar.push(data, size);
+    }
+
+    ///
+    /// Check that TAR is complete and get result of extraction
+    ///
+    auto finish() -> summary
+    {
+        tar.finish();
+        for (size_t rule = 0; rule < used.size(); rule++)
+            if (!used[rule])
+                result.missing.push_back(files.get_rule(rule));
+        return std::move(result);
+    }
+
+private:
+    auto select(archive::tar_entry const& entry) -> bool
+    {
+        targets = files.match(entry.name, entry.type == archive::tar_type::directory);
+        return !targets.empty();
+    }
+
+    auto write(archive::tar_entry const& entry, uint8_t const* data) -> void
+    {
+        auto linked = written.cend();
+        if (entry.type == archive::tar_type::hard_link) {
+            linked = written.find(entry.linkname);
+            if (linked == written.cend())
+                result.unlinked.push_back(entry.name + " -> " + entry.linkname); // its data is gone with the stream
+        }
+
+        for (auto const& item : targets) {
+            if (!files.whole())
+                used[item.rule] = true;
+            if (entry.type == archive::tar_type::hard_link && linked == written.cend())
+                continue;
+            switch (entry.type) {
+            case archive::tar_type::directory:
+                output.add_directory(item.path, entry.mode, entry.mtime);
+                break;
+            case archive::tar_type::symlink:
+                output.add_symlink(item.path, entry.linkname);
+                break;
+            case archive::tar_type::hard_link:
+                output.add_hard_link(item.path, linked->second, entry.mode, entry.mtime);
+                result.files++;
+                break;
+            case archive::tar_type::file:
+                output.add_file(item.path, data, static_cast<size_t>(entry.size), entry.mode, entry.mtime);
+                written.emplace(entry.name, item.path);
+                result.files++;
+                result.bytes += entry.size;
+                break;
+            default: // devices and fifos are never taken
+                break;
+            }
+        }
+    }
+
+    matcher const& files;
+    writer& output;
+    summary result {};
+    std::vector<bool> used {}; // items of list that matched something
+    std::vector<matcher::target> targets {}; // output paths of current entry
+    std::unordered_map<std::string, std::string> written {}; // entry name -> its first output path
+    archive::tar_stream tar;
+};
+
+} // namespace extract
@@ -1,76 +1,229 @@
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
+#include <chrono>
 #include <filesystem>
-#include <regex>
 #include <string>
 #include <vector>
 
+#include "cache.hpp"
 #include "curl.hpp"
 
 #include "archive.hpp"
+#include "extract.hpp"
+#include "pipeline.hpp"
+#include "repository.hpp"
+#include "resolver.hpp"
+#include "stats.hpp"
+#include "storage.hpp"
+#include "workers.hpp"
 #include <logger.hpp>
 
+///
+/// Package found in database of repository
+///
+struct package {
+    std::string name; // package name in database
+    std::string file_name; // full file name of package archive
+    std::string url; // download URL of package archive
+    std::string files; // list of files to take from package
+    std::string sha256; // checksum of package archive, key in package cache
+    std::string repo; // name of repository
+};
+
+///
+/// Package listed in ini file
+///
+struct configured_package {
+    size_t repo; // index of repository
+    std::string name; // package name in database
+    std::string version; // pinned version or empty for the newest one
+    std::string files; // list of files to take from package
+};
+
 ///
 /// Main function
 ///
 auto main() -> int
 try {
+    auto const run_start = stats::clock::now();
     makedump::logger logger { makedump::logger::format("{white+}", ">>>") };
     logger.println("Curl Version: {yellow}", curl::get_version());
 
     //reading from ini file
     boost::property_tree::ptree ini;
     boost::property_tree::read_ini("../settings/minimal.ini", ini);
+    auto const parallel_downloads = ini.get("Options.parallel_downloads", size_t { 8 });
+    auto const cache_dir = std::filesystem::path { ini.get("Options.cache_dir", std::string { "cache" }) };
+    auto const database_max_age = std::chrono::seconds { ini.get("Options.database_max_age", 3600) };
+    auto const resolve_dependencies = ini.get("Options.resolve_dependencies", false);
+    auto const output_dir = std::filesystem::path { ini.get("Options.output_dir", std::string { "output" }) };
+    auto const threads = ini.get("Options.threads", size_t { 0 });
+    auto const write_batches = ini.get("Options.write_batches", true);
+    auto const report_file = ini.get("Options.report_file", std::string {});
+
+    // one executor for decoding, hashing, parsing and writes keeps all cores busy
+    auto& executor = workers::shared_executor(threads);
+
+    // one session for all downloads to reuse connections to mirrors
+    curl::session session {};
 
     // find all not empty repositories
+    auto databases = std::vector<repository::database> {};
+    auto repo_urls = std::vector<std::string> {};
+    auto repo_names = std::vector<std::string> {};
+    auto configured = std::vector<configured_package> {};
+    auto timings = std::vector<stats::item> {}; // databases, then packages
     for (auto const& repo : ini.get_child("Repositories")) {
         auto const& repo_name = repo.first;
         auto repo_url = repo.second.get_value(std::string {});
         if (repo_name.empty() || repo_url.empty())
             continue;
 
-        logger.print("Get database for {yellow+} repository ...", repo_name);
-        auto db_tar_gz = curl::get_file(repo_url + '/' + repo_name + ".db.tar.gz");
-        logger.print("{green} ->", db_tar_gz.size());
-        auto db_tar = archive::gzip_unpack(db_tar_gz);
-        logger.println("{green+} bytes", db_tar.size());
+        // parsed database is taken from cache while it is fresh, after that it is
+        // revalidated by conditional request and downloaded again only if changed
+        auto db_url = repo_url + '/' + repo_name + ".db.tar.gz";
+        auto db_path = cache_dir / (repo_name + '-' + std::to_string(repository::hash(db_url)) + ".db");
+        auto& timing = timings.emplace_back(stats::item { repo_name, repo_name + ".db.tar.gz" });
+        auto parse_start = stats::clock::now();
+        auto db = repository::database::open(db_path, db_url);
+        timing.parse.seconds = stats::seconds_since(parse_start);
+        if (db && storage::file_age(db_path) <= database_max_age) {
+            logger.println("Get database for {yellow+} repository from cache", repo_name);
+        } else {
+            // unpack database while it is downloading
+            logger.print("Get database for {yellow+} repository ...", repo_name);
+            auto db_tar = std::vector<uint8_t> {};
+            auto db_tar_gz_size = size_t { 0 };
+            archive::gzip_stream db_stream { curl::append_to(db_tar) };
+            auto db_validators = db ? curl::response { 0, std::string { db->etag() }, std::string { db->last_modified() } } : curl::response {};
+            auto db_response = session.get_file(
+                db_url, [&](uint8_t const* data, size_t size) {
+                    auto decode_start = stats::clock::now();
+                    db_tar_gz_size += size;
+                    db_stream.push(data, size);
+                    timing.decode.seconds += stats::seconds_since(decode_start);
+                },
+                db_validators);
+            timing.transfer = db_response;
 
-        auto pkg_names = archive::tar_get_file_list(db_tar);
+            if (db && db_response.status == 304) {
+                logger.println(" not modified");
+                storage::touch(db_path);
+            } else {
+                db_stream.finish();
+                logger.print("{green} ->", db_tar_gz_size);
+                logger.println("{green+} bytes", db_tar.size());
+                parse_start = stats::clock::now();
+                db.emplace(archive::tar_index { db_tar }, db_url, db_response.etag, db_response.last_modified);
+                db->save(db_path);
+                timing.parse.seconds = stats::seconds_since(parse_start);
+                timing.decode.bytes = timing.parse.bytes = db_tar.size();
+            }
+        }
+        logger.println("Database has {green+} packages", db->size());
+        auto const pkg_prefix = std::string { (repo_name == "mingw64") ? "mingw-w64-x86_64-" : "" };
 
-        // find all not empty packages
+        // find all not empty packages, `name@version` pins a version
         for (auto const& pkg : ini.get_child(repo_name)) {
             auto const& pkg_name = pkg.first;
             auto const& pkg_files = pkg.second.get_value(std::string {});
             if (pkg_name.empty() || pkg_files.empty()) // skip empty
                 continue;
-
-            // find package name in database of repository
-            auto found = std::find_if(pkg_names.cbegin(), pkg_names.cend(), [&repo_name, &pkg_name](std::string const& value) {
-                return std::regex_match(value, std::regex { ((repo_name == "mingw64") ? "mingw-w64-x86_64-" : "") + pkg_name + ".*/desc" });
-            });
-            if (found == pkg_names.cend())
-                throw std::runtime_error("Not found `" + pkg_name + "` file in database");
-
-            // get a description of the found package
-            auto pkg_desc_raw = archive::tar_get_file(db_tar, *found);
-            auto pkg_desc = std::string(pkg_desc_raw.cbegin(), pkg_desc_raw.cend());
-
-            // get the full name of the found package
-            std::smatch match;
-            if (std::regex_search(pkg_desc, match, std::regex { "%FILENAME%\n(.*)\n" }) == false)
-                throw std::runtime_error("Not found `" + pkg_name + "` file name in descriptor file");
-            auto pkg_file_name = match.str(1);
-
-            // get package
-            logger.print("Get package {blue+} ...", pkg_file_name);
-            auto pkg_archive = curl::get_file(repo_url + '/' + pkg_file_name);
-            logger.print("{green} ->", pkg_archive.size());
-            auto pkg_tar = (pkg_file_name.rfind(".xz") != std::string::npos) ? archive::xz_unpack(pkg_archive) : archive::gzip_unpack(pkg_archive);
-            logger.println("{green+} bytes", pkg_tar.size());
-            auto file_names = archive::tar_get_file_list(pkg_tar);
-            for (auto value = file_names.begin(); value < file_names.begin() + 4; value++)
-                logger.println("{}", *value);
+            auto at = std::min(pkg_name.find('@'), pkg_name.size());
+            configured.push_back({ databases.size(), pkg_prefix + pkg_name.substr(0, at), pkg_name.substr(std::min(at + 1, pkg_name.size())), pkg_files });
         }
+        databases.push_back(std::move(*db));
+        repo_urls.push_back(repo_url);
+        repo_names.push_back(repo_name);
+    }
+
+    // find the newest or pinned versions of packages in their repositories
+    auto db_list = std::vector<repository::database const*> {};
+    for (auto const& db : databases)
+        db_list.push_back(&db);
+    auto const versions = resolver::version_index { db_list };
+    auto targets = std::vector<resolver::package> {};
+    for (auto const& pkg : configured) {
+        auto found = versions.find(pkg.name, pkg.version, pkg.repo);
+        if (!found)
+            throw std::runtime_error("Not found `" + pkg.name + (pkg.version.empty() ? "" : '@' + pkg.version) + "` file in database");
+        targets.push_back(*found);
+    }
+
+    // add dependencies of configured packages, they are taken whole
+    auto selected = targets;
+    if (resolve_dependencies) {
+        selected = resolver::graph { versions }.resolve(targets);
+        logger.println("Resolved {green+} packages", selected.size());
+    }
+
+    auto packages = std::vector<package> {};
+    for (auto const& item : selected) {
+        auto const& db = databases[item.repo];
+        auto pkg_name = std::string { db.name(item.index) };
+        auto pkg_files = std::string {};
+        for (size_t i = 0; i < targets.size(); i++)
+            if (targets[i].repo == item.repo && targets[i].index == item.index)
+                pkg_files = configured[i].files;
+
+        // get the full name of the found package
+        auto pkg_file_name = std::string { db.filename(item.index) };
+        if (pkg_file_name.empty())
+            throw std::runtime_error("Not found `" + pkg_name + "` file name in descriptor file");
+        if (!cache::is_file_name(pkg_file_name))
+            throw std::runtime_error("Not valid `" + pkg_name + "` file name `" + pkg_file_name + "` in descriptor file");
+        packages.push_back({ pkg_name, pkg_file_name, repo_urls[item.repo] + '/' + pkg_file_name, pkg_files, std::string { db.sha256(item.index) }, repo_names[item.repo] });
+    }
+
+    // take listed files of every package as soon as it is downloaded: packages are decoded,
+    // parsed and written in background while next packages are still downloading
+    extract::writer output { output_dir, executor, write_batches };
+    if (output.is_batched())
+        logger.println("Files are written by {green+} batches", "io_uring");
+    auto urls = std::vector<std::string> {};
+    auto sha256sums = std::vector<std::string> {};
+    auto file_lists = std::vector<std::string> {};
+    auto const first_package = timings.size();
+    for (auto const& pkg : packages) {
+        urls.push_back(pkg.url);
+        sha256sums.push_back(pkg.sha256);
+        file_lists.push_back(pkg.files);
+        timings.push_back({ pkg.repo, pkg.file_name });
+    }
+    pipeline::extractor extractor { output, executor, file_lists, [&](size_t i, pipeline::extractor::result const& extracted) {
+                                       logger.print("Package {blue+} {green} ->", packages[i].file_name, extracted.archive_size);
+                                       logger.print("{green+} bytes", extracted.taken.unpacked);
+                                       logger.println(", {green+} files", extracted.taken.files);
+                                       for (auto const& item : extracted.taken.missing)
+                                           logger.println("{yellow+} `{}` in package", "Not found", item);
+                                       for (auto const& item : extracted.taken.unlinked)
+                                           logger.println("{yellow+} hard link `{}`: its target isn't taken", "Skipped", item);
+                                       auto& timing = timings[first_package + i];
+                                       timing.decode = extracted.decode;
+                                       timing.parse = extracted.parse;
+                                       timing.extract = extracted.extract;
+                                       timing.files = extracted.taken.files;
+                                   } };
+
+    // get all packages at the same time
+    logger.println("Get {green+} packages ...", packages.size());
+    cache::get_files(session, urls, sha256sums, cache_dir / "packages", parallel_downloads, [&](size_t i, std::vector<uint8_t>&& data, curl::response const& transfer) {
+        timings[first_package + i].transfer = transfer;
+        extractor.push(i, std::move(data));
+    });
+    extractor.finish();
+    output.finish();
+
+    // time and data of every stage
+    for (auto const& line : stats::make_table(timings))
+        logger.println("{}", line);
+    logger.print("Written {green+} bytes", output.get_written_bytes());
+    logger.println(" in {green+} ms", static_cast<long>(output.get_write_seconds() * 1000));
+    logger.println("Done in {green+} ms", static_cast<long>(stats::seconds_since(run_start) * 1000));
+    if (!report_file.empty()) {
+        auto json = stats::make_json(timings, { output.get_write_seconds(), output.get_written_bytes() }, stats::seconds_since(run_start));
+        storage::write_file(report_file, json.data(), json.size());
+        logger.println("Report is written to {yellow+}", report_file);
     }
 
     return EXIT_SUCCESS;
@@ -0,0 +1,137 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "archive.hpp"
+#include "extract.hpp"
+#include "stats.hpp"
+#include "workers.hpp"
+
+namespace pipeline {
+
+///
+/// Stages of extraction after downloads, run by tasks of `pool`: every package is decoded
+/// by a task, its TAR is parsed chunk by chunk by sequential tasks and taken files are
+/// written by tasks of `output`. So while the next package is downloading the previous
+/// ones are decoded, parsed and written, many packages at once, and a huge package doesn't
+/// hold up small ones. Data between stages is bounded: a stage that is too far ahead
+/// runs tasks of slower ones until they catch up. `push` of a package waits for room too,
+/// but only blocks: the thread of transfers never decodes a package itself.
+///
+class extractor {
+public:
+    ///
+    /// Extraction of a package
+    ///
+    struct result {
+        size_t archive_size = 0;
+        extract::summary taken {};
+        stats::stage decode {}; // time of unpacking without waits for parsing, bytes of TAR
+        stats::stage parse {}; // time of parsing tasks, bytes of TAR
+        stats::stage extract {}; // from `push` till the end of parsing, bytes of taken files
+    };
+
+    ///
+    /// Called by a task when all entries of a package are taken, one call at a time
+    ///
+    using report = std::function<void(size_t index, result const& package)>;
+
+    static constexpr size_t archive_capacity = 64 << 20; // bytes of packed packages waiting for decoding
+    static constexpr size_t tar_capacity = 8 << 20; // bytes of TAR data of a package waiting for parsing
+    static constexpr size_t chunk_size = 1 << 20; // TAR data is passed to parsing by chunks of this size
+
+    ///
+    /// `file_lists[index]` is list of files to take from package `index`
+    ///
+    extractor(extract::writer& output, workers::executor& pool, std::vector<std::string> file_lists, report done)
+        : output { output }
+        , pool { pool }
+        , file_lists { std::move(file_lists) }
+        , done { std::move(done) }
+        , packages { pool, archive_capacity, false, false }
+    {
+    }
+
+    extractor(extractor const&) = delete;
+    auto operator=(extractor const&) -> extractor& = delete;
+
+    ///
+    /// Queue downloaded package for extraction, waits for room.
+    /// The first error of stages is thrown here
+    ///
+    auto push(size_t index, std::vector<uint8_t>&& archive) -> void
+    {
+        auto size = archive.size();
+        auto data = std::make_shared<std::vector<uint8_t>>(std::move(archive));
+        packages.run([this, index, data, start = stats::clock::now()]() { extract(index, *data, start); }, size);
+    }
+
+    ///
+    /// Wait until all pushed packages are parsed, the first error of stages is thrown here.
+    /// Files may still be written, `output.finish()` completes them
+    ///
+    auto finish() -> void
+    {
+        packages.wait();
+    }
+
+private:
+    ///
+    /// Decode package and queue parsing of its TAR
+    ///
+    auto extract(size_t index, std::vector<uint8_t>& archive, stats::clock::time_point start) -> void
+    {
+        auto files = extract::matcher { file_lists.at(index) };
+        extract::package_stream package { files, output };
+        auto times = result { archive.size() };
+
+        // time of parsing tasks is summed by them one by one
+        auto parse = [&times](auto&& step) {
+            auto step_start = stats::clock::now();
+            step();
+            times.parse.seconds += stats::seconds_since(step_start);
+        };
+        auto chunk = std::make_shared<std::vector<uint8_t>>();
+        auto passing = 0.0; // time of passes to parsing, it isn't decoding
+        workers::task_group parsing { pool, tar_capacity, true }; // after all its tasks use: on error it waits for them before that is gone
+        auto pass = [&]() {
+            auto pass_start = stats::clock::now();
+            auto size = chunk->size();
+            auto data = std::exchange(chunk, std::make_shared<std::vector<uint8_t>>());
+            parsing.run([&package, &parse, data]() { parse([&]() { package.push(data->data(), data->size()); }); }, size);
+            passing += stats::seconds_since(pass_start);
+        };
+        auto decode_start = stats::clock::now();
+        archive::unpack_to(archive, [&](uint8_t const* data, size_t size) {
+            chunk->insert(chunk->end(), data, data + size);
+            if (chunk->size() >= chunk_size)
+                pass();
+        });
+        if (!chunk->empty())
+            pass();
+        times.decode.seconds = stats::seconds_since(decode_start) - passing;
+
+        parsing.run([&]() {
+            parse([&]() { times.taken = package.finish(); });
+            times.decode.bytes = times.parse.bytes = times.taken.unpacked;
+            times.extract = { stats::seconds_since(start), times.taken.bytes };
+            std::lock_guard<std::mutex> lock { report_lock };
+            done(index, times);
+        });
+        parsing.wait();
+    }
+
+    extract::writer& output;
+    workers::executor& pool;
+    std::vector<std::string> file_lists;
+    report done;
+    std::mutex report_lock {};
+    workers::task_group packages; // decoding of packages
+};
+
+} // namespace pipeline
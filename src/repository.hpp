@@ -0,0 +1,446 @@
+#pragma once
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "archive.hpp"
+#include "storage.hpp"
+
+namespace repository {
+
+///
+/// Reference to string interned in arena of database
+///
+struct string_ref {
+    uint32_t offset;
+    uint32_t size;
+};
+
+///
+/// Reference to range of strings in flat list of database
+///
+struct list_ref {
+    uint32_t offset;
+    uint32_t size;
+};
+
+///
+/// View of string list in database (dependencies, provisions)
+///
+class string_list {
+public:
+    class iterator {
+    public:
+        iterator(char const* arena, string_ref const* ref)
+            : arena { arena }
+            , ref { ref }
+        {
+        }
+        auto operator*() const -> std::string_view { return { arena + ref->offset, ref->size }; }
+        auto operator++() -> iterator& { return ++ref, *this; }
+        auto operator!=(iterator const& other) const -> bool { return ref != other.ref; }
+
+    private:
+        char const* arena;
+        string_ref const* ref;
+    };
+
+    string_list(char const* arena, string_ref const* first, size_t size)
+        : arena { arena }
+        , first { first }
+        , count { size }
+    {
+    }
+    auto begin() const -> iterator { return { arena, first }; }
+    auto end() const -> iterator { return { arena, first + count }; }
+    auto size() const -> size_t { return count; }
+    auto empty() const -> bool { return count == 0; }
+
+private:
+    char const* arena;
+    string_ref const* first;
+    size_t count;
+};
+
+///
+/// FNV-1a hash of string. It is the same in every run, so it can be saved to disk.
+///
+inline auto hash(std::string_view value) -> uint64_t
+{
+    auto result = uint64_t { 0xCBF29CE484222325 };
+    for (auto symbol : value)
+        result = (result ^ static_cast<uint8_t>(symbol)) * 0x100000001B3;
+    return result;
+}
+
+///
+/// Header of database image. Tables follow the header in the order of `image_layout`.
+///
+struct image_header {
+    std::array<char, 8> magic; // "DEVTDB" and zeros
+    uint32_t version; // image format version
+    uint32_t packages; // number of packages
+    uint32_t lists; // number of strings in all lists
+    uint32_t buckets; // size of name hash table, power of two
+    uint64_t arena_size; // size of all strings
+    string_ref url; // URL of database archive
+    string_ref etag; // `ETag` of database archive
+    string_ref last_modified; // `Last-Modified` of database archive
+    uint64_t size; // size of the whole image
+};
+
+constexpr auto image_magic = std::array<char, 8> { 'D', 'E', 'V', 'T', 'D', 'B', '\0', '\0' };
+constexpr auto image_version = uint32_t { 2 };
+
+///
+/// Offsets of tables in database image, every table is aligned to 8 bytes
+///
+struct image_layout {
+    explicit image_layout(image_header const& header)
+    {
+        auto offset = size_t { 0 };
+        auto place = [&offset](size_t size) {
+            auto result = offset;
+            offset = (offset + size + 7) & ~size_t { 7 };
+            return result;
+        };
+        place(sizeof(image_header));
+        csizes = place(header.packages * sizeof(uint64_t));
+        isizes = place(header.packages * sizeof(uint64_t));
+        names = place(header.packages * sizeof(string_ref));
+        versions = place(header.packages * sizeof(string_ref));
+        filenames = place(header.packages * sizeof(string_ref));
+        sha256sums = place(header.packages * sizeof(string_ref));
+        depends = place(header.packages * sizeof(list_ref));
+        provides = place(header.packages * sizeof(list_ref));
+        lists = place(header.lists * sizeof(string_ref));
+        buckets = place(header.buckets * sizeof(uint32_t));
+        arena = place(header.arena_size);
+        size = offset;
+    }
+
+    size_t csizes, isizes, names, versions, filenames, sha256sums, depends, provides, lists, buckets, arena, size;
+};
+
+///
+/// Repository database parsed from all `desc` files of `.db.tar.gz` in one pass.
+/// Packages are kept as a struct of arrays, every string is interned once in one arena,
+/// so all queries run over compact tables and never parse text again.
+/// The tables live in one flat image, which can be saved to disk and mapped back
+/// into memory as is on the next run.
+///
+class database {
+public:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    explicit database(archive::tar_index const& db_index, std::string_view url = {}, std::string_view etag = {}, std::string_view last_modified = {})
+    {
+        constexpr auto desc = std::string_view { "/desc" };
+        auto is_desc = [desc](std::string_view path) {
+            return path.size() > desc.size() && path.substr(path.size() - desc.size()) == desc;
+        };
+
+        // the arena can't be bigger than all `desc` files, so it is never reallocated
+        // and interned strings can be found by views into it
+        auto arena_size = url.size() + etag.size() + last_modified.size();
+        for (auto const& entry : db_index.get_entries())
+            if (is_desc(entry.name))
+                arena_size += entry.size;
+
+        auto data = tables {};
+        data.arena.reserve(arena_size);
+        data.url = data.intern(url);
+        data.etag = data.intern(etag);
+        data.last_modified = data.intern(last_modified);
+        for (auto const& entry : db_index.get_entries())
+            if (is_desc(entry.name))
+                data.parse_desc(db_index.get_view(entry));
+
+        pack(data);
+    }
+
+    database(database const&) = delete;
+    auto operator=(database const&) -> database& = delete;
+    database(database&&) = default;
+    auto operator=(database&&) -> database& = default;
+
+    ///
+    /// Open database image saved by `save`, returns nothing if the file
+    /// doesn't exist, is broken or was made for another URL
+    ///
+    static auto open(std::filesystem::path const& path, std::string_view url) -> std::optional<database>
+    {
+        try {
+            if (!std::filesystem::exists(path))
+                return std::nullopt;
+            auto file = std::make_shared<storage::mapped_file>(path);
+            auto result = database { std::shared_ptr<uint8_t const> { file, file->data() }, file->size() };
+            if (result.url() != url)
+                return std::nullopt;
+            return result;
+        } catch (std::exception const&) {
+            return std::nullopt; // will be downloaded again
+        }
+    }
+
+    ///
+    /// Save database image to disk
+    ///
+    auto save(std::filesystem::path const& path) const -> void
+    {
+        storage::write_file(path, image.get(), header->size);
+    }
+
+    ///
+    /// Get number of packages
+    ///
+    auto size() const -> size_t { return header->packages; }
+
+    ///
+    /// Find package by exact name, returns `npos` if not found
+    ///
+    auto find(std::string_view name) const -> size_t
+    {
+        auto mask = header->buckets - 1;
+        for (auto slot = hash(name) & mask;; slot = (slot + 1) & mask) {
+            auto package = buckets[slot];
+            if (package == 0)
+                return npos;
+            if (get(names[package - 1]) == name)
+                return package - 1;
+        }
+    }
+
+    auto url() const -> std::string_view { return get(header->url); }
+    auto etag() const -> std::string_view { return get(header->etag); }
+    auto last_modified() const -> std::string_view { return get(header->last_modified); }
+
+    auto name(size_t package) const -> std::string_view { return get(names[package]); }
+    auto version(size_t package) const -> std::string_view { return get(versions[package]); }
+    auto filename(size_t package) const -> std::string_view { return get(filenames[package]); }
+    auto sha256(size_t package) const -> std::string_view { return get(sha256sums[package]); }
+    auto csize(size_t package) const -> uint64_t { return csizes[package]; }
+    auto isize(size_t package) const -> uint64_t { return isizes[package]; }
+    auto depends(size_t package) const -> string_list { return get(depends_lists[package]); }
+    auto provides(size_t package) const -> string_list { return get(provides_lists[package]); }
+
+private:
+    ///
+    /// Tables of database while it is parsed
+    ///
+    struct tables {
+        std::vector<char> arena {}; // all strings of database
+        std::unordered_map<std::string_view, string_ref> interned {}; // views into arena
+        std::vector<string_ref> lists {}; // all string lists of database
+        std::vector<string_ref> names {}, versions {}, filenames {}, sha256sums {};
+        std::vector<uint64_t> csizes {}, isizes {};
+        std::vector<list_ref> depends {}, provides {};
+        string_ref url {}, etag {}, last_modified {};
+
+        auto intern(std::string_view value) -> string_ref
+        {
+            auto found = interned.find(value);
+            if (found != interned.cend())
+                return found->second;
+            auto ref = string_ref { static_cast<uint32_t>(arena.size()), static_cast<uint32_t>(value.size()) };
+            arena.insert(arena.end(), value.begin(), value.end());
+            interned.emplace(std::string_view { arena.data() + ref.offset, ref.size }, ref);
+            return ref;
+        }
+
+        ///
+        /// Parse one `desc` file: `%FIELD%` line, value lines, empty line
+        ///
+        auto parse_desc(std::string_view text) -> void
+        {
+            auto name = string_ref {}, version = string_ref {}, filename = string_ref {}, sha256 = string_ref {};
+            auto csize = uint64_t { 0 }, isize = uint64_t { 0 };
+            auto depends_list = list_ref { static_cast<uint32_t>(lists.size()), 0 };
+            auto provides_items = std::vector<string_ref> {};
+
+            auto to_number = [](std::string_view value) {
+                auto result = uint64_t { 0 };
+                std::from_chars(value.data(), value.data() + value.size(), result);
+                return result;
+            };
+
+            auto field = std::string_view {};
+            while (!text.empty()) {
+                auto end = text.find('\n');
+                auto line = text.substr(0, end);
+                text = (end == std::string_view::npos) ? std::string_view {} : text.substr(end + 1);
+
+                if (line.empty()) {
+                    field = {};
+                } else if (field.empty()) {
+                    field = line;
+                } else if (field == "%NAME%") {
+                    name = intern(line);
+                } else if (field == "%VERSION%") {
+                    version = intern(line);
+                } else if (field == "%FILENAME%") {
+                    filename = intern(line);
+                } else if (field == "%SHA256SUM%") {
+                    sha256 = intern(line);
+                } else if (field == "%CSIZE%") {
+                    csize = to_number(line);
+                } else if (field == "%ISIZE%") {
+                    isize = to_number(line);
+                } else if (field == "%DEPENDS%") {
+                    lists.push_back(intern(line));
+                    depends_list.size++;
+                } else if (field == "%PROVIDES%") {
+                    provides_items.push_back(intern(line));
+                }
+            }
+
+            // every list is kept in one piece
+            auto provides_list = list_ref { static_cast<uint32_t>(lists.size()), static_cast<uint32_t>(provides_items.size()) };
+            lists.insert(lists.end(), provides_items.begin(), provides_items.end());
+
+            names.push_back(name);
+            versions.push_back(version);
+            filenames.push_back(filename);
+            sha256sums.push_back(sha256);
+            csizes.push_back(csize);
+            isizes.push_back(isize);
+            depends.push_back(depends_list);
+            provides.push_back(provides_list);
+        }
+    };
+
+    ///
+    /// Attach database to image in memory, the image is checked before use
+    ///
+    database(std::shared_ptr<uint8_t const> data, size_t size)
+        : image { std::move(data) }
+    {
+        if (size < sizeof(image_header))
+            throw std::runtime_error("Database image is too small");
+        header = reinterpret_cast<image_header const*>(image.get());
+        if (header->magic != image_magic || header->version != image_version || header->size != size)
+            throw std::runtime_error("Database image has wrong format");
+        if (header->buckets == 0 || (header->buckets & (header->buckets - 1)) != 0 || header->buckets <= header->packages)
+            throw std::runtime_error("Database image has wrong hash table");
+
+        auto layout = image_layout { *header };
+        if (layout.size != size)
+            throw std::runtime_error("Database image has wrong size");
+        auto table = [this](size_t offset) { return image.get() + offset; };
+        csizes = reinterpret_cast<uint64_t const*>(table(layout.csizes));
+        isizes = reinterpret_cast<uint64_t const*>(table(layout.isizes));
+        names = reinterpret_cast<string_ref const*>(table(layout.names));
+        versions = reinterpret_cast<string_ref const*>(table(layout.versions));
+        filenames = reinterpret_cast<string_ref const*>(table(layout.filenames));
+        sha256sums = reinterpret_cast<string_ref const*>(table(layout.sha256sums));
+        depends_lists = reinterpret_cast<list_ref const*>(table(layout.depends));
+        provides_lists = reinterpret_cast<list_ref const*>(table(layout.provides));
+        lists = reinterpret_cast<string_ref const*>(table(layout.lists));
+        buckets = reinterpret_cast<uint32_t const*>(table(layout.buckets));
+        arena = reinterpret_cast<char const*>(table(layout.arena));
+
+        // references must stay inside of their tables
+        auto check = [this](auto ref, size_t limit) {
+            if (ref.offset > limit || ref.size > limit - ref.offset)
+                throw std::runtime_error("Database image has wrong reference");
+        };
+        check(header->url, header->arena_size);
+        check(header->etag, header->arena_size);
+        check(header->last_modified, header->arena_size);
+        for (size_t i = 0; i < header->packages; i++) {
+            for (auto ref : { names[i], versions[i], filenames[i], sha256sums[i] })
+                check(ref, header->arena_size);
+            check(depends_lists[i], header->lists);
+            check(provides_lists[i], header->lists);
+        }
+        for (size_t i = 0; i < header->lists; i++)
+            check(lists[i], header->arena_size);
+        // every package takes one slot at most, so a search always meets an empty one
+        auto used = size_t { 0 };
+        for (size_t i = 0; i < header->buckets; i++) {
+            if (buckets[i] > header->packages)
+                throw std::runtime_error("Database image has wrong hash table");
+            used += buckets[i] != 0;
+        }
+        if (used > header->packages)
+            throw std::runtime_error("Database image has wrong hash table");
+    }
+
+    ///
+    /// Pack parsed tables into one image
+    ///
+    auto pack(tables const& data) -> void
+    {
+        auto new_header = image_header {};
+        new_header.magic = image_magic;
+        new_header.version = image_version;
+        new_header.packages = static_cast<uint32_t>(data.names.size());
+        new_header.lists = static_cast<uint32_t>(data.lists.size());
+        new_header.buckets = 1;
+        while (new_header.buckets <= new_header.packages * 2) // load factor <= 0.5
+            new_header.buckets *= 2;
+        new_header.arena_size = data.arena.size();
+        new_header.url = data.url;
+        new_header.etag = data.etag;
+        new_header.last_modified = data.last_modified;
+        auto layout = image_layout { new_header };
+        new_header.size = layout.size;
+
+        auto result = std::make_shared<std::vector<uint8_t>>(layout.size);
+        auto copy = [&result](size_t offset, auto const& table) {
+            std::memcpy(result->data() + offset, table.data(), table.size() * sizeof(table[0]));
+        };
+        std::memcpy(result->data(), &new_header, sizeof(new_header));
+        copy(layout.csizes, data.csizes);
+        copy(layout.isizes, data.isizes);
+        copy(layout.names, data.names);
+        copy(layout.versions, data.versions);
+        copy(layout.filenames, data.filenames);
+        copy(layout.sha256sums, data.sha256sums);
+        copy(layout.depends, data.depends);
+        copy(layout.provides, data.provides);
+        copy(layout.lists, data.lists);
+        copy(layout.arena, data.arena);
+
+        // open addressing hash table of names, keeps package number + 1 (0 is empty slot)
+        auto table = reinterpret_cast<uint32_t*>(result->data() + layout.buckets);
+        auto mask = new_header.buckets - 1;
+        for (uint32_t package = 0; package < new_header.packages; package++) {
+            auto name = std::string_view { data.arena.data() + data.names[package].offset, data.names[package].size };
+            auto slot = hash(name) & mask;
+            while (table[slot] != 0 && std::string_view { data.arena.data() + data.names[table[slot] - 1].offset, data.names[table[slot] - 1].size } != name)
+                slot = (slot + 1) & mask;
+            if (table[slot] == 0) // the first one in database wins
+                table[slot] = package + 1;
+        }
+
+        *this = database { std::shared_ptr<uint8_t const> { result, result->data() }, layout.size };
+    }
+
+    auto get(string_ref ref) const -> std::string_view { return { arena + ref.offset, ref.size }; }
+    auto get(list_ref ref) const -> string_list { return { arena, lists + ref.offset, ref.size }; }
+
+    std::shared_ptr<uint8_t const> image {}; // memory or mapped file
+    image_header const* header = nullptr;
+    uint64_t const* csizes = nullptr;
+    uint64_t const* isizes = nullptr;
+    string_ref const* names = nullptr;
+    string_ref const* versions = nullptr;
+    string_ref const* filenames = nullptr;
+    string_ref const* sha256sums = nullptr;
+    list_ref const* depends_lists = nullptr;
+    list_ref const* provides_lists = nullptr;
+    string_ref const* lists = nullptr; // all string lists of database
+    uint32_t const* buckets = nullptr; // hash table of names
+    char const* arena = nullptr; // all strings of database
+};
+
+} // namespace repository
@@ -0,0 +1,379 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "repository.hpp"
+
+namespace resolver {
+
+///
+/// Compare alpha or numeric parts of versions like `rpmvercmp` of pacman
+///
+inline auto compare_parts(std::string_view one, std::string_view two) -> int
+{
+    auto is_digit = [](char symbol) { return symbol >= '0' && symbol <= '9'; };
+    auto is_alpha = [](char symbol) { return (symbol >= 'a' && symbol <= 'z') || (symbol >= 'A' && symbol <= 'Z'); };
+    auto is_alnum = [&](char symbol) { return is_digit(symbol) || is_alpha(symbol); };
+    if (one == two)
+        return 0;
+
+    size_t i = 0, j = 0; // positions in `one` and `two`
+    while (i < one.size() && j < two.size()) {
+        // skip separators, the longer separator wins
+        auto separator_i = i, separator_j = j;
+        while (i < one.size() && !is_alnum(one[i]))
+            i++;
+        while (j < two.size() && !is_alnum(two[j]))
+            j++;
+        if (i == one.size() || j == two.size())
+            break;
+        if (i - separator_i != j - separator_j)
+            return (i - separator_i < j - separator_j) ? -1 : 1;
+
+        // take segments of the same kind
+        auto is_number = is_digit(one[i]);
+        auto same_kind = is_number ? +is_digit : +is_alpha;
+        auto end_i = i, end_j = j;
+        while (end_i < one.size() && same_kind(one[end_i]))
+            end_i++;
+        while (end_j < two.size() && same_kind(two[end_j]))
+            end_j++;
+        if (end_j == j) // numeric segment is newer than alpha one
+            return is_number ? 1 : -1;
+
+        auto segment_one = one.substr(i, end_i - i), segment_two = two.substr(j, end_j - j);
+        if (is_number) {
+            auto zeros_one = std::min(segment_one.find_first_not_of('0'), segment_one.size());
+            auto zeros_two = std::min(segment_two.find_first_not_of('0'), segment_two.size());
+            segment_one.remove_prefix(zeros_one);
+            segment_two.remove_prefix(zeros_two);
+            if (segment_one.size() != segment_two.size())
+                return (segment_one.size() < segment_two.size()) ? -1 : 1;
+        }
+        if (auto result = segment_one.compare(segment_two); result != 0)
+            return (result < 0) ? -1 : 1;
+        i = end_i;
+        j = end_j;
+    }
+
+    if (i == one.size() && j == two.size())
+        return 0;
+    // remaining alpha string never beats an empty string
+    if ((i == one.size() && !(j < two.size() && is_alpha(two[j]))) || (i < one.size() && is_alpha(one[i])))
+        return -1;
+    return 1;
+}
+
+///
+/// Version split into `epoch:version-release`
+///
+struct version_parts {
+    std::string_view epoch;
+    std::string_view version;
+    std::string_view release; // empty if there is no release
+    bool has_release;
+};
+
+inline auto split_version(std::string_view value) -> version_parts
+{
+    auto result = version_parts { "0", value, {}, false };
+    auto digits = std::min(value.find_first_not_of("0123456789"), value.size());
+    if (digits < value.size() && value[digits] == ':') {
+        if (digits > 0)
+            result.epoch = value.substr(0, digits);
+        result.version = value.substr(digits + 1);
+    }
+    if (auto dash = result.version.rfind('-'); dash != std::string_view::npos) {
+        result.release = result.version.substr(dash + 1);
+        result.has_release = true;
+        result.version = result.version.substr(0, dash);
+    }
+    return result;
+}
+
+///
+/// Compare split versions: release is compared only if both versions have it
+///
+inline auto compare_versions(version_parts const& one, version_parts const& two) -> int
+{
+    auto result = compare_parts(one.epoch, two.epoch);
+    if (result == 0)
+        result = compare_parts(one.version, two.version);
+    if (result == 0 && one.has_release && two.has_release)
+        result = compare_parts(one.release, two.release);
+    return result;
+}
+
+///
+/// Compare package versions like `vercmp` of pacman: < 0 if `one` is older,
+/// 0 if they are equal, > 0 if `one` is newer
+///
+inline auto vercmp(std::string_view one, std::string_view two) -> int
+{
+    if (one == two)
+        return 0;
+    return compare_versions(split_version(one), split_version(two));
+}
+
+///
+/// Dependency like `name`, `name>=1.0` or `name=1.0-2`
+///
+struct dependency {
+    enum class relation { any, less, less_equal, equal, greater_equal, greater };
+
+    std::string_view name;
+    relation op;
+    std::string_view version;
+
+    ///
+    /// Parse dependency string of `%DEPENDS%` or `%PROVIDES%`
+    ///
+    static auto parse(std::string_view value) -> dependency
+    {
+        auto position = value.find_first_of("<>=");
+        if (position == std::string_view::npos)
+            return { value, relation::any, {} };
+
+        auto op = relation::equal;
+        auto length = size_t { 1 };
+        auto has_equal = position + 1 < value.size() && value[position + 1] == '=';
+        if (value[position] == '<')
+            op = has_equal ? relation::less_equal : relation::less;
+        else if (value[position] == '>')
+            op = has_equal ? relation::greater_equal : relation::greater;
+        if (value[position] != '=' && has_equal)
+            length = 2;
+        return { value.substr(0, position), op, value.substr(position + length) };
+    }
+
+    ///
+    /// Check that `candidate` version satisfies the dependency
+    ///
+    auto accepts(std::string_view candidate) const -> bool
+    {
+        return op == relation::any || accepts(split_version(candidate));
+    }
+
+    auto accepts(version_parts const& candidate) const -> bool
+    {
+        if (op == relation::any)
+            return true;
+        auto result = compare_versions(candidate, split_version(version));
+        switch (op) {
+        case relation::less:
+            return result < 0;
+        case relation::less_equal:
+            return result <= 0;
+        case relation::equal:
+            return result == 0;
+        case relation::greater_equal:
+            return result >= 0;
+        case relation::greater:
+            return result > 0;
+        default:
+            return true;
+        }
+    }
+};
+
+///
+/// Package of one of resolved repositories
+///
+struct package {
+    size_t repo; // index of repository database
+    size_t index; // index of package in database
+};
+
+///
+/// All versions of every package name in databases of all repositories.
+/// Versions are split once and kept sorted from the newest one, so the newest
+/// version is the first one and a pinned version is found by binary search.
+/// Equal versions keep the order of repositories.
+///
+class version_index {
+public:
+    struct entry {
+        std::string_view name;
+        version_parts version;
+        package item;
+    };
+
+    explicit version_index(std::vector<repository::database const*> databases)
+        : databases { std::move(databases) }
+    {
+        for (size_t repo = 0; repo < this->databases.size(); repo++) {
+            auto const& db = *this->databases[repo];
+            for (size_t index = 0; index < db.size(); index++)
+                entries.push_back({ db.name(index), split_version(db.version(index)), { repo, index } });
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](entry const& one, entry const& two) {
+            if (one.name != two.name)
+                return one.name < two.name;
+            return compare_versions(one.version, two.version) > 0;
+        });
+        for (size_t first = 0, last = 0; first < entries.size(); first = last) {
+            while (last < entries.size() && entries[last].name == entries[first].name)
+                last++;
+            ranges.emplace(entries[first].name, std::make_pair(first, last));
+        }
+    }
+
+    auto get_databases() const -> std::vector<repository::database const*> const& { return databases; }
+
+    ///
+    /// Get all versions of package from the newest one
+    ///
+    auto versions(std::string_view name) const -> std::pair<entry const*, entry const*>
+    {
+        auto found = ranges.find(name);
+        if (found == ranges.cend())
+            return { nullptr, nullptr };
+        return { entries.data() + found->second.first, entries.data() + found->second.second };
+    }
+
+    ///
+    /// Find the newest package by name, or the package of pinned `version`
+    /// (without release any release matches), in `repo` or in all repositories
+    ///
+    auto find(std::string_view name, std::string_view version = {}, size_t repo = any_repo) const -> std::optional<package>
+    {
+        auto [first, last] = versions(name);
+        if (!version.empty()) {
+            auto pinned = split_version(version);
+            first = std::partition_point(first, last, [&pinned](entry const& item) { return compare_versions(item.version, pinned) > 0; });
+            last = std::partition_point(first, last, [&pinned](entry const& item) { return compare_versions(item.version, pinned) == 0; });
+        }
+        for (; first != last; first++)
+            if (repo == any_repo || first->item.repo == repo)
+                return first->item;
+        return std::nullopt;
+    }
+
+    static constexpr size_t any_repo = static_cast<size_t>(-1);
+
+private:
+    std::vector<repository::database const*> databases {};
+    std::vector<entry> entries {}; // sorted by name and version
+    std::unordered_map<std::string_view, std::pair<size_t, size_t>> ranges {}; // entries of every name
+};
+
+///
+/// Dependency graph over databases of all repositories. Packages are nodes numbered
+/// through all databases, names are found by version index and provisions
+/// by one hash table built once, edges are found while the graph is walked.
+///
+class graph {
+public:
+    explicit graph(version_index const& index)
+        : index { index }
+        , databases { index.get_databases() }
+    {
+        for (auto const* db : databases) {
+            first.push_back(nodes);
+            nodes += db->size();
+        }
+        for (size_t repo = 0; repo < databases.size(); repo++) {
+            auto const& db = *databases[repo];
+            for (size_t item = 0; item < db.size(); item++)
+                for (auto provision : db.provides(item)) {
+                    auto parsed = dependency::parse(provision);
+                    provisions[parsed.name].push_back({ first[repo] + item, parsed.op == dependency::relation::equal ? parsed.version : std::string_view {} });
+                }
+        }
+    }
+
+    ///
+    /// Find package for dependency, the newest package with the same name is taken
+    /// before a package that provides the name
+    ///
+    auto find(std::string_view value) const -> std::optional<package>
+    {
+        auto candidates = find_candidates(dependency::parse(value));
+        if (candidates.empty())
+            return std::nullopt;
+        return to_package(candidates.front());
+    }
+
+    ///
+    /// Resolve all dependencies of `targets` transitively, packages are returned
+    /// in install order: every package follows its dependencies. A package already
+    /// taken is preferred for a dependency, cycles are broken at the package seen first.
+    ///
+    auto resolve(std::vector<package> const& targets) -> std::vector<package>
+    {
+        state.assign(nodes, mark::none);
+        auto result = std::vector<package> {};
+        for (auto const& target : targets)
+            visit(first[target.repo] + target.index, result);
+        return result;
+    }
+
+private:
+    enum class mark : uint8_t { none, visiting, done };
+
+    struct provision {
+        size_t node;
+        std::string_view version; // empty if provision has no version
+    };
+
+    auto to_package(size_t node) const -> package
+    {
+        auto repo = size_t { 0 };
+        while (repo + 1 < first.size() && first[repo + 1] <= node)
+            repo++;
+        return { repo, node - first[repo] };
+    }
+
+    auto find_candidates(dependency const& wanted) const -> std::vector<size_t>
+    {
+        auto result = std::vector<size_t> {};
+        auto [first_version, last_version] = index.versions(wanted.name);
+        for (auto version = first_version; version != last_version; version++)
+            if (wanted.accepts(version->version))
+                result.push_back(first[version->item.repo] + version->item.index);
+        if (auto found = provisions.find(wanted.name); found != provisions.cend())
+            for (auto const& item : found->second)
+                if (wanted.op == dependency::relation::any || (!item.version.empty() && wanted.accepts(item.version)))
+                    result.push_back(item.node);
+        return result;
+    }
+
+    auto pick(std::string_view value, std::string_view required_by) const -> size_t
+    {
+        auto candidates = find_candidates(dependency::parse(value));
+        if (candidates.empty())
+            throw std::runtime_error("Not found `" + std::string { value } + "` required by `" + std::string { required_by } + "`");
+        for (auto node : candidates)
+            if (state[node] != mark::none)
+                return node;
+        return candidates.front();
+    }
+
+    auto visit(size_t node, std::vector<package>& result) -> void
+    {
+        if (state[node] != mark::none)
+            return; // done or a cycle
+        state[node] = mark::visiting;
+        auto current = to_package(node);
+        auto const& db = *databases[current.repo];
+        for (auto depend : db.depends(current.index))
+            visit(pick(depend, db.name(current.index)), result);
+        state[node] = mark::done;
+        result.push_back(current);
+    }
+
+    version_index const& index;
+    std::vector<repository::database const*> const& databases;
+    std::vector<size_t> first {}; // number of the first node of every database
+    size_t nodes = 0;
+    std::unordered_map<std::string_view, std::vector<provision>> provisions {};
+    std::vector<mark> state {}; // marks of nodes while graph is walked
+};
+
+} // namespace resolver
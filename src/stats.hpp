@@ -0,0 +1,211 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "curl.hpp"
+
+namespace stats {
+
+using clock = std::chrono::steady_clock;
+
+///
+/// Seconds from `start` till now
+///
+inline auto seconds_since(clock::time_point start) -> double
+{
+    return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+///
+/// Wall time and data of a stage
+///
+struct stage {
+    double seconds = 0;
+    uint64_t bytes = 0;
+};
+
+///
+/// Stages of a repository database or a package
+///
+struct item {
+    std::string repo; // repository name
+    std::string name; // file name of database or package
+    curl::response transfer {}; // status 0 if it is taken from cache without request
+    stage decode {}; // unpacking: its time and bytes of TAR
+    stage parse {}; // TAR parsing: its time and bytes of TAR
+    stage extract {}; // from download till all entries are taken: wall time and bytes of taken files
+    size_t files = 0; // number of taken files
+};
+
+///
+/// Durations of transfer phases, `curl` gives times from the start of transfer
+///
+struct phases {
+    double dns = 0;
+    double connect = 0;
+    double tls = 0;
+    double wait = 0; // from request till the first byte of response
+    double transfer = 0; // from the first byte till the end
+};
+
+inline auto get_phases(curl::timing const& times) -> phases
+{
+    auto result = phases {};
+    result.dns = times.name_lookup;
+    auto connected = std::max(times.connect, times.name_lookup);
+    if (times.connect > 0)
+        result.connect = connected - times.name_lookup;
+    auto secured = std::max(times.tls, connected);
+    if (times.tls > 0)
+        result.tls = secured - connected;
+    result.wait = std::max(times.first_byte - secured, 0.0);
+    result.transfer = std::max(times.total - std::max(times.first_byte, secured), 0.0);
+    return result;
+}
+
+///
+/// Names of repositories in order of their first items
+///
+inline auto get_repos(std::vector<item> const& items) -> std::vector<std::string>
+{
+    auto result = std::vector<std::string> {};
+    for (auto const& entry : items)
+        if (std::find(result.begin(), result.end(), entry.repo) == result.end())
+            result.push_back(entry.repo);
+    return result;
+}
+
+///
+/// Wall time of transfers of repository: from the start of the first one till the end
+/// of the last one, so parallel transfers are counted once
+///
+inline auto get_transfer_wall(std::vector<item> const& items, std::string const& repo) -> double
+{
+    auto first = clock::time_point::max(), last = clock::time_point::min();
+    for (auto const& entry : items) {
+        if (entry.repo != repo || entry.transfer.status == 0)
+            continue;
+        auto total = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(entry.transfer.times.total));
+        first = std::min(first, entry.transfer.times.end - total);
+        last = std::max(last, entry.transfer.times.end);
+    }
+    return first < last ? std::chrono::duration<double>(last - first).count() : 0.0;
+}
+
+///
+/// Lines of summary table, times are in milliseconds. Items are grouped by repository,
+/// the total line of a repository shows its downloaded bytes, wall time of its transfers
+/// and speed of its mirror by this time
+///
+inline auto make_table(std::vector<item> const& items) -> std::vector<std::string>
+{
+    auto line = [](char const* format, auto... values) {
+        char buffer[512];
+        std::snprintf(buffer, sizeof(buffer), format, values...);
+        return std::string { buffer };
+    };
+    auto ms = [](double seconds) { return static_cast<long>(seconds * 1000 + 0.5); };
+    char const* row = "%-8s %6s %6ld %7ld %6ld %6ld %8ld %10llu %7ld %6ld %8ld %6zu  %s";
+
+    auto result = std::vector<std::string> {};
+    result.push_back(line("%-8s %6s %6s %7s %6s %6s %8s %10s %7s %6s %8s %6s  %s",
+        "repo", "source", "dns", "connect", "tls", "wait", "transfer", "bytes", "decode", "parse", "extract", "files", "file"));
+    for (auto const& repo : get_repos(items)) {
+        auto bytes = uint64_t { 0 };
+        for (auto const& entry : items) {
+            if (entry.repo != repo)
+                continue;
+            auto status = entry.transfer.status == 0 ? std::string { "cache" } : std::to_string(entry.transfer.status);
+            auto times = get_phases(entry.transfer.times);
+            result.push_back(line(row, repo.c_str(), status.c_str(), ms(times.dns), ms(times.connect), ms(times.tls), ms(times.wait), ms(times.transfer),
+                static_cast<unsigned long long>(entry.transfer.times.bytes), ms(entry.decode.seconds), ms(entry.parse.seconds), ms(entry.extract.seconds),
+                entry.files, entry.name.c_str()));
+            bytes += entry.transfer.times.bytes;
+        }
+        auto seconds = get_transfer_wall(items, repo);
+        auto speed = seconds > 0 ? static_cast<double>(bytes) / seconds / 1024 : 0.0;
+        result.push_back(line("%-8s %6s %48llu bytes downloaded in %ld ms, %.1f KiB/s",
+            repo.c_str(), "total", static_cast<unsigned long long>(bytes), ms(seconds), speed));
+    }
+    return result;
+}
+
+///
+/// Quote string for JSON
+///
+inline auto json_string(std::string_view text) -> std::string
+{
+    auto result = std::string { "\"" };
+    for (auto symbol : text) {
+        if (symbol == '"' || symbol == '\\') {
+            result += '\\';
+            result += symbol;
+        } else if (static_cast<unsigned char>(symbol) < 0x20) {
+            char buffer[8];
+            std::snprintf(buffer, sizeof(buffer), "\\u%04x", static_cast<unsigned>(symbol));
+            result += buffer;
+        } else {
+            result += symbol;
+        }
+    }
+    return result + '"';
+}
+
+inline auto json_number(double value) -> std::string
+{
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6f", value);
+    return buffer;
+}
+
+inline auto json_stage(stage const& value) -> std::string
+{
+    return "{\"seconds\": " + json_number(value.seconds) + ", \"bytes\": " + std::to_string(value.bytes) + "}";
+}
+
+///
+/// JSON report: total time of run, writes of files (time is summed over tasks)
+/// and all stages of every item grouped by repository, times are in seconds.
+/// A repository has wall time of its transfers and their time summed over them
+///
+inline auto make_json(std::vector<item> const& items, stage const& writes, double total_seconds) -> std::string
+{
+    auto result = std::string { "{\n" };
+    result += "  \"seconds\": " + json_number(total_seconds) + ",\n";
+    result += "  \"writes\": " + json_stage(writes) + ",\n";
+    result += "  \"repositories\": [";
+    auto repos = get_repos(items);
+    for (size_t r = 0; r < repos.size(); r++) {
+        auto bytes = uint64_t { 0 };
+        auto seconds = 0.0;
+        auto entries = std::string {};
+        for (auto const& entry : items) {
+            if (entry.repo != repos[r])
+                continue;
+            auto times = get_phases(entry.transfer.times);
+            entries += entries.empty() ? "\n" : ",\n";
+            entries += "        {\"name\": " + json_string(entry.name) + ", \"status\": " + std::to_string(entry.transfer.status)
+                + ",\n         \"transfer\": {\"dns\": " + json_number(times.dns) + ", \"connect\": " + json_number(times.connect)
+                + ", \"tls\": " + json_number(times.tls) + ", \"wait\": " + json_number(times.wait)
+                + ", \"transfer\": " + json_number(times.transfer) + ", \"total\": " + json_number(entry.transfer.times.total)
+                + ", \"bytes\": " + std::to_string(entry.transfer.times.bytes) + "},\n"
+                + "         \"decode\": " + json_stage(entry.decode) + ", \"parse\": " + json_stage(entry.parse)
+                + ", \"extract\": " + json_stage(entry.extract) + ", \"files\": " + std::to_string(entry.files) + "}";
+            bytes += entry.transfer.times.bytes;
+            seconds += entry.transfer.times.total;
+        }
+        result += r == 0 ? "\n" : ",\n";
+        result += "    {\"name\": " + json_string(repos[r]) + ", \"bytes\": " + std::to_string(bytes)
+            + ", \"transfer_seconds\": " + json_number(get_transfer_wall(items, repos[r]))
+            + ", \"summed_transfer_seconds\": " + json_number(seconds) + ",\n     \"items\": [" + entries + "\n     ]}";
+    }
+    result += repos.empty() ? "]\n}\n" : "\n  ]\n}\n";
+    return result;
+}
+
+} // namespace stats
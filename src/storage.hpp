@@ -0,0 +1,207 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace storage {
+
+///
+/// Read-only file mapped into memory
+///
+class mapped_file {
+public:
+    explicit mapped_file(std::filesystem::path const& path)
+    {
+#ifdef _WIN32
+        auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error { "Not open `" + path.string() + "` file" };
+        auto file_size = LARGE_INTEGER {};
+        auto mapping = GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0
+            ? CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr)
+            : nullptr;
+        CloseHandle(file);
+        if (mapping == nullptr)
+            throw std::runtime_error { "Not map `" + path.string() + "` file" };
+        address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping); // the view keeps mapping alive
+        if (address == nullptr)
+            throw std::runtime_error { "Not map `" + path.string() + "` file" };
+        length = static_cast<size_t>(file_size.QuadPart);
+#else
+        auto file = open(path.c_str(), O_RDONLY);
+        if (file < 0)
+            throw std::runtime_error { "Not open `" + path.string() + "` file" };
+        struct stat file_stat { };
+        auto mapped = (fstat(file, &file_stat) == 0 && file_stat.st_size > 0)
+            ? mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, file, 0)
+            : MAP_FAILED;
+        close(file); // the mapping keeps file open
+        if (mapped == MAP_FAILED)
+            throw std::runtime_error { "Not map `" + path.string() + "` file" };
+        address = mapped;
+        length = static_cast<size_t>(file_stat.st_size);
+#endif
+    }
+
+    ~mapped_file()
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(address);
+#else
+        munmap(address, length);
+#endif
+    }
+
+    mapped_file(mapped_file const&) = delete;
+    auto operator=(mapped_file const&) -> mapped_file& = delete;
+
+    auto data() const -> uint8_t const* { return static_cast<uint8_t const*>(address); }
+    auto size() const -> size_t { return length; }
+
+private:
+    void* address = nullptr;
+    size_t length = 0;
+};
+
+///
+/// Read the whole file into byte array
+///
+inline auto read_file(std::filesystem::path const& path) -> std::vector<uint8_t>
+{
+    std::ifstream file { path, std::ios::binary };
+    if (!file)
+        throw std::runtime_error { "Not open `" + path.string() + "` file" };
+    auto result = std::vector<uint8_t>(std::filesystem::file_size(path));
+    file.read(reinterpret_cast<char*>(result.data()), static_cast<std::streamsize>(result.size()));
+    if (!file)
+        throw std::runtime_error { "Not read `" + path.string() + "` file" };
+    return result;
+}
+
+///
+/// Write file at once: data goes to a temporary file which then replaces the target,
+/// so readers never see a half-written file
+///
+inline auto write_file(std::filesystem::path const& path, void const* data, size_t size) -> void
+{
+    if (path.has_parent_path())
+        std::filesystem::create_directories(path.parent_path());
+
+    auto temp_path = path;
+    temp_path += ".tmp";
+    {
+        std::ofstream file { temp_path, std::ios::binary | std::ios::trunc };
+        file.write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+        if (!file)
+            throw std::runtime_error { "Not write `" + temp_path.string() + "` file" };
+    }
+    std::filesystem::rename(temp_path, path);
+}
+
+///
+/// Write new file in place without temporary file: its size is allocated at once,
+/// then data goes by large writes at offsets aligned to write size
+///
+inline auto put_file(std::filesystem::path const& path, void const* data, size_t size) -> void
+{
+    constexpr size_t write_size = 8 << 20; // 8 Mb
+    auto bytes = static_cast<char const*>(data);
+#ifdef _WIN32
+    auto file = CreateFileW(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error { "Not open `" + path.string() + "` file" };
+    auto allocation = FILE_ALLOCATION_INFO {};
+    allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+    SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation)); // only a hint
+    for (size_t offset = 0; offset < size;) {
+        auto written = DWORD { 0 };
+        if (!WriteFile(file, bytes + offset, static_cast<DWORD>(std::min(size - offset, write_size)), &written, nullptr) || written == 0) {
+            CloseHandle(file);
+            throw std::runtime_error { "Not write `" + path.string() + "` file" };
+        }
+        offset += written;
+    }
+    CloseHandle(file);
+#else
+    auto file = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0644); // never through a symbolic link
+    if (file < 0)
+        throw std::runtime_error { "Not open `" + path.string() + "` file" };
+#ifdef __linux__
+    if (size > 0)
+        fallocate(file, 0, 0, static_cast<off_t>(size)); // only a hint, not all file systems support it
+#endif
+    for (size_t offset = 0; offset < size;) {
+        auto written = write(file, bytes + offset, std::min(size - offset, write_size));
+        if (written <= 0) {
+            close(file);
+            throw std::runtime_error { "Not write `" + path.string() + "` file" };
+        }
+        offset += static_cast<size_t>(written);
+    }
+    if (close(file) != 0)
+        throw std::runtime_error { "Not write `" + path.string() + "` file" };
+#endif
+}
+
+///
+/// Set permission bits and time of last change (seconds since epoch) of file or directory,
+/// permissions are kept on Windows. Setuid, setgid and sticky bits are never set: modes come from archives
+///
+inline auto set_file_meta(std::filesystem::path const& path, uint32_t mode, int64_t mtime) -> void
+{
+#ifdef _WIN32
+    (void)mode;
+    auto file = CreateFileW(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error { "Not open `" + path.string() + "` file" };
+    auto ticks = static_cast<uint64_t>((mtime + 11644473600) * 10000000); // 100 ns since 1601
+    auto time = FILETIME { static_cast<DWORD>(ticks), static_cast<DWORD>(ticks >> 32) };
+    auto done = SetFileTime(file, nullptr, &time, &time);
+    CloseHandle(file);
+#else
+    struct timespec times[2] = { { static_cast<time_t>(mtime), 0 }, { static_cast<time_t>(mtime), 0 } };
+    auto done = chmod(path.c_str(), static_cast<mode_t>(mode & 0777)) == 0 && utimensat(AT_FDCWD, path.c_str(), times, 0) == 0;
+#endif
+    if (!done)
+        throw std::runtime_error { "Not set attributes of `" + path.string() + "` file" };
+}
+
+///
+/// Get time passed since last change of file
+///
+inline auto file_age(std::filesystem::path const& path) -> std::chrono::seconds
+{
+    auto changed = std::filesystem::last_write_time(path);
+    return std::chrono::duration_cast<std::chrono::seconds>(std::filesystem::file_time_type::clock::now() - changed);
+}
+
+///
+/// Mark file as changed right now
+///
+inline auto touch(std::filesystem::path const& path) -> void
+{
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now());
+}
+
+} // namespace storage
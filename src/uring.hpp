@@ -0,0 +1,279 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// direct descriptors (`file_index`) are required to link open, write and close of a file
+#if defined(IORING_FILE_INDEX_ALLOC) && defined(__NR_io_uring_setup)
+#define URING_ENABLED
+#endif
+
+namespace uring {
+
+///
+/// File to write: data must live until it is written
+///
+struct file {
+    std::filesystem::path path;
+    uint8_t const* data;
+    size_t size;
+};
+
+#ifdef URING_ENABLED
+
+///
+/// Ring of io_uring queues. Every file is written by linked operations `open`, `write`
+/// and `close` on a direct descriptor, so a batch of many files costs one system call.
+/// Ring is used by one thread.
+///
+class ring {
+public:
+    explicit ring(unsigned max_files)
+        : slots { max_files }
+    {
+        auto params = io_uring_params {};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, max_files * 4, &params));
+        if (fd < 0)
+            throw std::system_error { errno, std::generic_category(), "io_uring setup" };
+
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        sq_ring = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ring = (params.features & IORING_FEAT_SINGLE_MMAP)
+            ? sq_ring
+            : mmap(nullptr, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        auto sqes_area = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes_area == MAP_FAILED) {
+            release();
+            throw std::runtime_error("io_uring map error");
+        }
+        sqes = static_cast<io_uring_sqe*>(sqes_area);
+
+        auto field = [](void* ring, uint32_t offset) { return reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(ring) + offset); };
+        sq_tail = field(sq_ring, params.sq_off.tail);
+        sq_mask = *field(sq_ring, params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        sq_array = field(sq_ring, params.sq_off.array);
+        cq_head = field(cq_ring, params.cq_off.head);
+        cq_tail = field(cq_ring, params.cq_off.tail);
+        cq_mask = *field(cq_ring, params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(static_cast<uint8_t*>(cq_ring) + params.cq_off.cqes);
+
+        // empty table of direct descriptors, one slot for every file of a batch
+        auto files = io_uring_rsrc_register {};
+        files.nr = slots;
+        files.flags = IORING_RSRC_REGISTER_SPARSE;
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0) {
+            auto error = errno;
+            release();
+            throw std::system_error { error, std::generic_category(), "io_uring register files" };
+        }
+    }
+
+    ~ring()
+    {
+        release();
+    }
+
+    ring(ring const&) = delete;
+    auto operator=(ring const&) -> ring& = delete;
+
+    ///
+    /// Check that kernel supports all operations used to write files
+    ///
+    auto supports_writes() -> bool
+    {
+        auto probe = std::vector<uint8_t>(sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op));
+        auto info = reinterpret_cast<io_uring_probe*>(probe.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, info, IORING_OP_LAST) < 0)
+            return false;
+        auto supported = [info](unsigned op) { return op <= info->last_op && (info->ops[op].flags & IO_URING_OP_SUPPORTED) != 0; };
+        return supported(IORING_OP_OPENAT) && supported(IORING_OP_WRITE) && supported(IORING_OP_CLOSE);
+    }
+
+    ///
+    /// Write files by batches of linked operations, waits until all files are written
+    ///
+    auto write_files(std::vector<file> const& files) -> void
+    {
+        constexpr size_t max_write = 1 << 30; // size of one write operation
+        auto error = std::string {};
+        for (size_t first = 0; first < files.size();) {
+            // fill queue with whole chains of operations of files
+            auto tail = *sq_tail;
+            auto count = size_t { 0 }; // files in batch
+            auto operations = size_t { 0 };
+            for (; first + count < files.size() && count < slots; count++) {
+                auto const& item = files[first + count];
+                auto writes = (item.size + max_write - 1) / max_write;
+                if (operations + writes + 2 > sq_entries && count > 0)
+                    break;
+                auto slot = static_cast<uint32_t>(count);
+                auto tag = static_cast<uint64_t>(first + count) << 24; // index of file, then index of write
+
+                auto sqe = next_sqe(tail);
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                sqe->addr = reinterpret_cast<uint64_t>(item.path.c_str());
+                sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW; // direct descriptor is never inherited, O_CLOEXEC is not allowed
+                sqe->len = 0644;
+                sqe->file_index = slot + 1;
+                sqe->flags = IOSQE_IO_LINK;
+                sqe->user_data = tag | operation_open;
+                for (size_t offset = 0; offset < item.size; offset += max_write) {
+                    sqe = next_sqe(tail);
+                    sqe->opcode = IORING_OP_WRITE;
+                    sqe->fd = static_cast<int32_t>(slot);
+                    sqe->addr = reinterpret_cast<uint64_t>(item.data + offset);
+                    sqe->len = static_cast<uint32_t>(std::min(item.size - offset, max_write));
+                    sqe->off = offset;
+                    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+                    sqe->user_data = tag | (offset / max_write) << 2 | operation_write;
+                }
+                sqe = next_sqe(tail);
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->file_index = slot + 1;
+                sqe->user_data = tag | operation_close;
+                operations += writes + 2;
+            }
+            __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+            // submit batch and take all its completions
+            auto to_submit = operations;
+            for (auto completed = size_t { 0 }; completed < operations;) {
+                auto entered = syscall(__NR_io_uring_enter, fd, static_cast<unsigned>(to_submit), 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (entered < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                    throw std::system_error { errno, std::generic_category(), "io_uring enter" };
+                if (entered > 0)
+                    to_submit -= static_cast<size_t>(entered);
+
+                auto head = *cq_head;
+                for (auto cq_end = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE); head != cq_end; head++, completed++) {
+                    auto const& cqe = cqes[head & cq_mask];
+                    auto const& item = files[cqe.user_data >> 24];
+                    auto operation = cqe.user_data & 3;
+                    auto offset = static_cast<size_t>((cqe.user_data & 0xFFFFFF) >> 2) * max_write;
+                    if (cqe.res == -ECANCELED || !error.empty())
+                        continue; // an earlier operation of chain is failed
+                    if (cqe.res < 0)
+                        error = "Not " + std::string(operation == operation_open ? "open" : operation == operation_write ? "write" : "close")
+                            + " `" + item.path.string() + "` file: " + std::strerror(-cqe.res);
+                    else if (operation == operation_write && static_cast<size_t>(cqe.res) != std::min(item.size - offset, max_write))
+                        error = "Not write `" + item.path.string() + "` file";
+                }
+                __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            }
+            if (!error.empty())
+                throw std::runtime_error { error };
+            first += count;
+        }
+    }
+
+private:
+    static constexpr uint64_t operation_open = 0, operation_write = 1, operation_close = 2;
+
+    auto next_sqe(uint32_t& tail) -> io_uring_sqe*
+    {
+        auto index = tail++ & sq_mask;
+        sq_array[index] = index;
+        auto sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    auto release() -> void
+    {
+        if (sqes != nullptr)
+            munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+            munmap(cq_ring, cq_size);
+        if (sq_ring != MAP_FAILED)
+            munmap(sq_ring, sq_size);
+        close(fd);
+    }
+
+    unsigned slots; // size of table of direct descriptors, files in one batch
+    int fd = -1;
+    void* sq_ring = MAP_FAILED;
+    void* cq_ring = MAP_FAILED;
+    size_t sq_size = 0, cq_size = 0, sqes_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    uint32_t* sq_tail = nullptr;
+    uint32_t* sq_array = nullptr;
+    uint32_t sq_mask = 0;
+    uint32_t sq_entries = 0;
+    uint32_t* cq_head = nullptr;
+    uint32_t* cq_tail = nullptr;
+    uint32_t cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+};
+
+#endif
+
+///
+/// Number of files in one batch of operations
+///
+constexpr unsigned batch_files = 256;
+
+///
+/// Check once that io_uring can write files here: kernel has it, it isn't forbidden
+/// (containers often do it) and it supports direct descriptors
+///
+inline auto is_supported() -> bool
+{
+#ifdef URING_ENABLED
+    static auto const supported = []() {
+        try {
+            return ring { batch_files }.supports_writes();
+        } catch (std::exception const&) {
+            return false;
+        }
+    }();
+    return supported;
+#else
+    return false;
+#endif
+}
+
+///
+/// Write files by batches of io_uring operations in the current thread,
+/// every thread keeps its own ring
+///
+inline auto write_files(std::vector<file> const& files) -> void
+{
+#ifdef URING_ENABLED
+    thread_local auto instance = std::unique_ptr<ring> {};
+    if (!instance)
+        instance = std::make_unique<ring>(batch_files);
+    try {
+        instance->write_files(files);
+    } catch (...) {
+        instance.reset(); // descriptors of failed chains may stay in the table
+        throw;
+    }
+#else
+    (void)files;
+    throw std::runtime_error("io_uring is not supported");
+#endif
+}
+
+} // namespace uring
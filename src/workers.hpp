@@ -0,0 +1,276 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace workers {
+
+using task = std::function<void()>;
+
+///
+/// Work-stealing executor. Every worker has its own queue: tasks submitted by a worker
+/// go to its own queue and are taken back from its end, so nested work stays hot in
+/// cache; an idle worker steals the oldest tasks of others. Tasks from other threads
+/// are spread over queues. A thread waiting for a group of tasks runs queued ones
+/// of that group itself (see `task_group`), so nested work never waits for a free worker.
+///
+class executor {
+public:
+    explicit executor(size_t threads)
+    {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; i++)
+            queues.push_back(std::make_unique<queue>());
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this, i]() { work(i); });
+    }
+
+    ~executor()
+    {
+        {
+            std::lock_guard<std::mutex> lock { sleep_lock };
+            stopping = true;
+        }
+        has_task.notify_all();
+        for (auto& thread : workers)
+            thread.join();
+    }
+
+    executor(executor const&) = delete;
+    auto operator=(executor const&) -> executor& = delete;
+
+    ///
+    /// Queue task, it must not throw
+    ///
+    auto submit(task job) -> void
+    {
+        auto home = (current.owner == this) ? current.index : next_queue++ % queues.size();
+        queued++; // before the task is visible, so a worker never sleeps over it
+        {
+            std::lock_guard<std::mutex> lock { queues[home]->lock };
+            queues[home]->tasks.push_back(std::move(job));
+        }
+        {
+            std::lock_guard<std::mutex> lock { sleep_lock };
+        }
+        has_task.notify_one();
+    }
+
+    auto get_thread_count() const -> size_t { return workers.size(); }
+
+private:
+    struct queue {
+        std::mutex lock {};
+        std::deque<task> tasks {};
+    };
+
+    struct worker_of {
+        executor const* owner; // null in other threads
+        size_t index; // index of own queue
+    };
+
+    ///
+    /// Take the newest task of queue `home` or steal the oldest one of other queues
+    ///
+    auto take(size_t home, task& job) -> bool
+    {
+        for (size_t i = 0; i < queues.size(); i++) {
+            auto& victim = *queues[(home + i) % queues.size()];
+            std::lock_guard<std::mutex> lock { victim.lock };
+            if (victim.tasks.empty())
+                continue;
+            if (i == 0 && current.owner == this) {
+                job = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+            } else {
+                job = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    auto work(size_t index) -> void
+    {
+        current = { this, index };
+        while (true) {
+            auto job = task {};
+            if (take(index, job)) {
+                job();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock { sleep_lock };
+            has_task.wait(lock, [this]() { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+
+    static inline thread_local worker_of current {}; // executor and queue of the current thread
+
+    std::vector<std::unique_ptr<queue>> queues {}; // one for every worker
+    std::atomic<size_t> queued { 0 }; // number of tasks in all queues
+    std::atomic<size_t> next_queue { 0 }; // queue for the next task from outside
+    std::mutex sleep_lock {};
+    std::condition_variable has_task {}; // a task is queued or executor is stopping
+    bool stopping = false;
+    std::vector<std::thread> workers {};
+};
+
+///
+/// Executor shared by all stages of the program. The first call makes it with `threads`
+/// workers (0 is one per core), later calls return the same executor.
+///
+inline auto shared_executor(size_t threads = 0) -> executor&
+{
+    static executor instance { threads > 0 ? threads : std::thread::hardware_concurrency() };
+    return instance;
+}
+
+///
+/// Tasks of a stage run by `pool`. Every task has a weight (bytes of data it holds,
+/// for example), `run` waits while the weight of queued and running tasks is over `capacity`,
+/// so memory of tasks in flight is bounded; a heavier task than `capacity` runs alone.
+/// Tasks of a `sequential` group run one by one in order of `run`.
+/// A waiting thread runs queued tasks of this group meanwhile, never tasks of other groups,
+/// so a small wait isn't held up by a huge task of another stage. Without `helping`
+/// it only blocks: a thread that must stay responsive, the one of transfers for example.
+/// After an error the remaining tasks are skipped, the first error is thrown by `run` and `wait`.
+///
+class task_group {
+public:
+    explicit task_group(executor& pool, size_t capacity = SIZE_MAX, bool sequential = false, bool helping = true)
+        : pool { pool }
+        , capacity { capacity }
+        , sequential { sequential }
+        , helping { helping }
+    {
+    }
+
+    ~task_group()
+    {
+        help_until([this]() { return group->count == 0; });
+    }
+
+    task_group(task_group const&) = delete;
+    auto operator=(task_group const&) -> task_group& = delete;
+
+    ///
+    /// Queue task, waits while there is no room for its weight
+    ///
+    auto run(task job, size_t weight = 1) -> void
+    {
+        help_until([&]() { return group->error || group->pending == 0 || group->pending + weight <= capacity; });
+        {
+            std::lock_guard<std::mutex> lock { group->lock };
+            if (group->error)
+                std::rethrow_exception(group->error);
+            group->pending += weight;
+            group->count++;
+            group->queued.emplace_back(std::move(job), weight);
+        }
+        // the executor task may run after a waiter took the job or the group is gone
+        pool.submit([state = group, sequential = sequential]() {
+            std::unique_lock<std::mutex> lock { state->lock };
+            run_queued(lock, *state, sequential);
+        });
+    }
+
+    ///
+    /// Wait for all queued tasks, the first exception of tasks is thrown here
+    ///
+    auto wait() -> void
+    {
+        help_until([this]() { return group->count == 0; });
+        std::lock_guard<std::mutex> lock { group->lock };
+        if (group->error)
+            std::rethrow_exception(std::exchange(group->error, nullptr));
+    }
+
+private:
+    ///
+    /// State shared with executor tasks of the group, they may outlive it
+    ///
+    struct state {
+        std::mutex lock {};
+        std::condition_variable changed {}; // a task is done
+        size_t pending = 0; // weight of queued and running tasks
+        size_t count = 0; // number of queued and running tasks
+        std::deque<std::pair<task, size_t>> queued {}; // tasks not started yet with their weights
+        bool running = false; // a task of sequential group is running
+        std::exception_ptr error {}; // first exception of tasks
+    };
+
+    ///
+    /// Run the next queued task, or all of them in order for a sequential group unless
+    /// another thread runs them. Returns `false` if there was nothing to run
+    ///
+    static auto run_queued(std::unique_lock<std::mutex>& lock, state& group, bool sequential) -> bool
+    {
+        auto ran = false;
+        while (!group.queued.empty() && !(sequential && group.running)) {
+            auto [job, weight] = std::move(group.queued.front());
+            group.queued.pop_front();
+            group.running = sequential;
+            execute(lock, group, job, weight);
+            group.running = false;
+            ran = true;
+            if (!sequential)
+                break;
+        }
+        return ran;
+    }
+
+    ///
+    /// Run task unless group has failed, `lock` is released meanwhile
+    ///
+    static auto execute(std::unique_lock<std::mutex>& lock, state& group, task const& job, size_t weight) -> void
+    {
+        auto skip = group.error != nullptr;
+        lock.unlock();
+        try {
+            if (!skip)
+                job();
+        } catch (...) {
+            lock.lock();
+            if (!group.error)
+                group.error = std::current_exception();
+            lock.unlock();
+        }
+        lock.lock();
+        group.pending -= weight;
+        group.count--;
+        group.changed.notify_all();
+    }
+
+    ///
+    /// Run queued tasks of the group, if `helping`, until `ready` (checked under lock) is true
+    ///
+    template <typename predicate>
+    auto help_until(predicate ready) -> void
+    {
+        std::unique_lock<std::mutex> lock { group->lock };
+        while (!ready())
+            if (!helping || !run_queued(lock, *group, sequential))
+                group->changed.wait(lock);
+    }
+
+    executor& pool;
+    size_t capacity;
+    bool sequential;
+    bool helping;
+    std::shared_ptr<state> group { std::make_shared<state>() };
+};
+
+} // namespace workers
@@ -24,8 +24,6 @@
   UInt32 MY_FAST_CALL CrcUpdateT8(UInt32 v, const void *data, size_t size, const UInt32 *table);
 #endif
 
-typedef UInt32 (MY_FAST_CALL *CRC_FUNC)(UInt32 v, const void *data, size_t size, const UInt32 *table);
-
 CRC_FUNC g_CrcUpdateT4;
 CRC_FUNC g_CrcUpdateT8;
 CRC_FUNC g_CrcUpdate;
@@ -90,6 +88,12 @@ void MY_FAST_CALL CrcGenerateTable()
         g_CrcUpdate = CrcUpdateT8;
     #endif
 
+    {
+      CRC_FUNC f = CrcGetFunc_Clmul();
+      if (f)
+        g_CrcUpdate = f;
+    }
+
   #else
   {
     #ifndef MY_CPU_BE
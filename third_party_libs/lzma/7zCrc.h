@@ -20,6 +20,11 @@ void MY_FAST_CALL CrcGenerateTable(void);
 UInt32 MY_FAST_CALL CrcUpdate(UInt32 crc, const void *data, size_t size);
 UInt32 MY_FAST_CALL CrcCalc(const void *data, size_t size);
 
+typedef UInt32 (MY_FAST_CALL *CRC_FUNC)(UInt32 v, const void *data, size_t size, const UInt32 *table);
+
+/* CRC code with carry-less multiplication (CrcClmul.c), NULL if CPU or compiler has no such code */
+CRC_FUNC CrcGetFunc_Clmul(void);
+
 EXTERN_C_END
 
 #endif
@@ -15,6 +15,10 @@
 #include <intrin.h>
 #endif
 
+#ifdef _MSC_VER
+#include <immintrin.h>
+#endif
+
 #if defined(USE_ASM) && !defined(MY_CPU_AMD64)
 static UInt32 CheckFlag(UInt32 flag)
 {
@@ -99,14 +103,14 @@ void MyCPUID(UInt32 function, UInt32 *a, UInt32 *b, UInt32 *c, UInt32 *d)
   #endif
       "=c" (*c) ,
       "=d" (*d)
-    : "0" (function)) ;
+    : "0" (function), "2" (0)) ;
 
   #endif
   
   #else
 
   int CPUInfo[4];
-  __cpuid(CPUInfo, function);
+  __cpuidex(CPUInfo, function, 0);
   *a = CPUInfo[0];
   *b = CPUInfo[1];
   *c = CPUInfo[2];
@@ -197,6 +201,68 @@ BoolInt CPU_Is_Aes_Supported()
   return (p.c >> 25) & 1;
 }
 
+/* leaf 7 (structured extended features) is read with subleaf 0 */
+
+static UInt32 x86cpuid_GetExtFeatures(const Cx86cpuid *p)
+{
+  UInt32 d[4] = { 0 };
+  if (p->maxFunc < 7)
+    return 0;
+  MyCPUID(7, &d[0], &d[1], &d[2], &d[3]);
+  return d[1];
+}
+
+/* OS saves XMM and YMM registers on context switch */
+
+static BoolInt CPU_Sys_Is_AVX_Supported(const Cx86cpuid *p)
+{
+  UInt32 a, d;
+  if (((p->c >> 27) & 1) == 0) /* OSXSAVE */
+    return False;
+  #ifdef _MSC_VER
+  {
+    unsigned __int64 v = _xgetbv(0);
+    a = (UInt32)v;
+    d = (UInt32)(v >> 32);
+  }
+  #else
+  __asm__ __volatile__ ("xgetbv" : "=a" (a), "=d" (d) : "c" (0));
+  #endif
+  (void)d;
+  return (a & 6) == 6;
+}
+
+BoolInt CPU_IsSupported_CLMUL()
+{
+  Cx86cpuid p;
+  CHECK_SYS_SSE_SUPPORT
+  if (!x86cpuid_CheckAndRead(&p))
+    return False;
+  return ((p.c >> 1) & 1) && ((p.c >> 19) & 1); /* PCLMULQDQ, SSE4.1 */
+}
+
+BoolInt CPU_IsSupported_SHA()
+{
+  Cx86cpuid p;
+  CHECK_SYS_SSE_SUPPORT
+  if (!x86cpuid_CheckAndRead(&p))
+    return False;
+  if (((p.c >> 9) & 1) == 0 || ((p.c >> 19) & 1) == 0) /* SSSE3, SSE4.1 */
+    return False;
+  return (x86cpuid_GetExtFeatures(&p) >> 29) & 1;
+}
+
+BoolInt CPU_IsSupported_AVX2()
+{
+  Cx86cpuid p;
+  CHECK_SYS_SSE_SUPPORT
+  if (!x86cpuid_CheckAndRead(&p))
+    return False;
+  if (((p.c >> 28) & 1) == 0 || !CPU_Sys_Is_AVX_Supported(&p)) /* AVX */
+    return False;
+  return (x86cpuid_GetExtFeatures(&p) >> 5) & 1;
+}
+
 BoolInt CPU_IsSupported_PageGB()
 {
   Cx86cpuid cpuid;
@@ -328,6 +328,9 @@ int x86cpuid_GetFirm(const Cx86cpuid *p);
 BoolInt CPU_Is_InOrder();
 BoolInt CPU_Is_Aes_Supported();
 BoolInt CPU_IsSupported_PageGB();
+BoolInt CPU_IsSupported_CLMUL();
+BoolInt CPU_IsSupported_SHA();
+BoolInt CPU_IsSupported_AVX2();
 
 #endif
 
@@ -0,0 +1,134 @@
+/* CrcClmul.c -- CRC32 and CRC64 calculation with carry-less multiplication (PCLMULQDQ)
+Public domain */
+
+#include "Precomp.h"
+
+#include "7zCrc.h"
+#include "XzCrc64.h"
+#include "CpuArch.h"
+
+#ifdef MY_CPU_X86_OR_AMD64
+
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 4)))
+  #define USE_CLMUL
+  #define ATTRIB_CLMUL __attribute__((__target__("pclmul,sse4.1")))
+#elif defined(_MSC_VER) && (_MSC_VER >= 1600)
+  #define USE_CLMUL
+  #define ATTRIB_CLMUL
+#endif
+
+#endif
+
+#ifdef USE_CLMUL
+
+#include <immintrin.h>
+
+/*
+Both CRCs are bit-reflected, so a 16-byte block is (lo, hi) with lo first in the stream.
+A block followed by D bits of data is folded into the data as
+  lo * (x^(D+63) mod P) + hi * (x^(D-1) mod P),
+constants are reflected 64-bit values. Folding keeps 4 blocks in flight (D = 512),
+then they are folded to one block (D = 128). CRC of the last block and of the tail
+is calculated with tables, so no Barrett reduction is required.
+*/
+
+#define CLMUL_FOLD(x, k, y) \
+  _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11)), y)
+
+#define CLMUL_LOAD(p) _mm_loadu_si128((const __m128i *)(const void *)(p))
+
+/* folds data (size >= 64) to one 16-byte block, the rest of data (< 16 bytes) is not processed */
+
+ATTRIB_CLMUL
+static __m128i ClmulFold(__m128i x0, const Byte *p, size_t size, __m128i k4, __m128i k1)
+{
+  __m128i x1, x2, x3;
+
+  x0 = _mm_xor_si128(x0, CLMUL_LOAD(p));
+  x1 = CLMUL_LOAD(p + 16);
+  x2 = CLMUL_LOAD(p + 32);
+  x3 = CLMUL_LOAD(p + 48);
+  p += 64;
+  size -= 64;
+
+  for (; size >= 64; size -= 64, p += 64)
+  {
+    x0 = CLMUL_FOLD(x0, k4, CLMUL_LOAD(p));
+    x1 = CLMUL_FOLD(x1, k4, CLMUL_LOAD(p + 16));
+    x2 = CLMUL_FOLD(x2, k4, CLMUL_LOAD(p + 32));
+    x3 = CLMUL_FOLD(x3, k4, CLMUL_LOAD(p + 48));
+  }
+
+  x0 = CLMUL_FOLD(x0, k1, x1);
+  x0 = CLMUL_FOLD(x0, k1, x2);
+  x0 = CLMUL_FOLD(x0, k1, x3);
+
+  for (; size >= 16; size -= 16, p += 16)
+    x0 = CLMUL_FOLD(x0, k1, CLMUL_LOAD(p));
+
+  return x0;
+}
+
+#ifdef MY_CPU_LE
+
+UInt32 MY_FAST_CALL CrcUpdateT8(UInt32 v, const void *data, size_t size, const UInt32 *table);
+
+ATTRIB_CLMUL
+static UInt32 MY_FAST_CALL CrcUpdateClmul(UInt32 v, const void *data, size_t size, const UInt32 *table)
+{
+  const Byte *p = (const Byte *)data;
+  size_t folded = size & ~(size_t)15;
+  __m128i block;
+
+  if (size < 64)
+    return CrcUpdateT8(v, data, size, table);
+
+  block = ClmulFold(_mm_cvtsi32_si128((int)v), p, size,
+      _mm_set_epi64x((Int64)UINT64_CONST(0xcad38e8f00000000), (Int64)UINT64_CONST(0x653d982200000000)),
+      _mm_set_epi64x((Int64)UINT64_CONST(0x9ba54c6f00000000), (Int64)UINT64_CONST(0x65673b4600000000)));
+  v = CrcUpdateT8(0, &block, 16, table);
+  return CrcUpdateT8(v, p + folded, size - folded, table);
+}
+
+UInt64 MY_FAST_CALL XzCrc64UpdateT4(UInt64 v, const void *data, size_t size, const UInt64 *table);
+
+ATTRIB_CLMUL
+static UInt64 MY_FAST_CALL XzCrc64UpdateClmul(UInt64 v, const void *data, size_t size, const UInt64 *table)
+{
+  const Byte *p = (const Byte *)data;
+  size_t folded = size & ~(size_t)15;
+  __m128i block;
+
+  if (size < 64)
+    return XzCrc64UpdateT4(v, data, size, table);
+
+  block = ClmulFold(_mm_set_epi64x(0, (Int64)v), p, size,
+      _mm_set_epi64x((Int64)UINT64_CONST(0x081f6054a7842df4), (Int64)UINT64_CONST(0x6ae3efbb9dd441f3)),
+      _mm_set_epi64x((Int64)UINT64_CONST(0xdabe95afc7875f40), (Int64)UINT64_CONST(0xe05dd497ca393ae4)));
+  v = XzCrc64UpdateT4(0, &block, 16, table);
+  return XzCrc64UpdateT4(v, p + folded, size - folded, table);
+}
+
+#define USE_CLMUL_LE
+
+#endif
+
+#endif
+
+CRC_FUNC CrcGetFunc_Clmul(void)
+{
+  #ifdef USE_CLMUL_LE
+  if (CPU_IsSupported_CLMUL())
+    return CrcUpdateClmul;
+  #endif
+  return NULL;
+}
+
+CRC64_FUNC Crc64GetFunc_Clmul(void)
+{
+  #ifdef USE_CLMUL_LE
+  if (CPU_IsSupported_CLMUL())
+    return XzCrc64UpdateClmul;
+  #endif
+  return NULL;
+}
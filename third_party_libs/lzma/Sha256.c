@@ -1,5 +1,6 @@
 /* Crypto/Sha256.c -- SHA-256 Hash
 2017-04-03 : Igor Pavlov : Public domain
+(blocks are hashed directly from input, CPU specific code is in Sha256Opt.c)
 This code is based on public domain code from Wei Dai's Crypto++ library. */
 
 #include "Precomp.h"
@@ -39,6 +40,8 @@ void Sha256_Init(CSha256 *p)
 #define blk0(i) (W[i])
 #define blk2(i) (W[i] += s1(W[((i)-2)&15]) + W[((i)-7)&15] + s0(W[((i)-15)&15]))
 
+#define K SHA256_K_ARRAY
+
 #define Ch(x,y,z) (z^(x&(y^z)))
 #define Maj(x,y,z) ((x&y)|(z&(x|y)))
 
@@ -90,7 +93,7 @@ void Sha256_Init(CSha256 *p)
 
 #endif
 
-static const UInt32 K[64] = {
+const UInt32 SHA256_K_ARRAY[64] = {
   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
   0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -109,11 +112,10 @@ static const UInt32 K[64] = {
   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-static void Sha256_WriteByteBlock(CSha256 *p)
+static void MY_FAST_CALL Sha256_UpdateBlocks(UInt32 state[8], const Byte *data, size_t numBlocks)
 {
   UInt32 W[16];
   unsigned j;
-  UInt32 *state;
 
   #ifdef _SHA256_UNROLL2
   UInt32 a,b,c,d,e,f,g,h;
@@ -121,50 +123,54 @@ static void Sha256_WriteByteBlock(CSha256 *p)
   UInt32 T[8];
   #endif
 
-  for (j = 0; j < 16; j += 4)
+  do
   {
-    const Byte *ccc = p->buffer + j * 4;
-    W[j    ] = GetBe32(ccc);
-    W[j + 1] = GetBe32(ccc + 4);
-    W[j + 2] = GetBe32(ccc + 8);
-    W[j + 3] = GetBe32(ccc + 12);
-  }
+    for (j = 0; j < 16; j += 4)
+    {
+      const Byte *ccc = data + j * 4;
+      W[j    ] = GetBe32(ccc);
+      W[j + 1] = GetBe32(ccc + 4);
+      W[j + 2] = GetBe32(ccc + 8);
+      W[j + 3] = GetBe32(ccc + 12);
+    }
 
-  state = p->state;
+    #ifdef _SHA256_UNROLL2
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+    #else
+    for (j = 0; j < 8; j++)
+      T[j] = state[j];
+    #endif
+
+    for (j = 0; j < 64; j += 16)
+    {
+      RX_16
+    }
 
-  #ifdef _SHA256_UNROLL2
-  a = state[0];
-  b = state[1];
-  c = state[2];
-  d = state[3];
-  e = state[4];
-  f = state[5];
-  g = state[6];
-  h = state[7];
-  #else
-  for (j = 0; j < 8; j++)
-    T[j] = state[j];
-  #endif
+    #ifdef _SHA256_UNROLL2
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+    #else
+    for (j = 0; j < 8; j++)
+      state[j] += T[j];
+    #endif
 
-  for (j = 0; j < 64; j += 16)
-  {
-    RX_16
+    data += 64;
   }
+  while (--numBlocks != 0);
 
-  #ifdef _SHA256_UNROLL2
-  state[0] += a;
-  state[1] += b;
-  state[2] += c;
-  state[3] += d;
-  state[4] += e;
-  state[5] += f;
-  state[6] += g;
-  state[7] += h;
-  #else
-  for (j = 0; j < 8; j++)
-    state[j] += T[j];
-  #endif
-  
   /* Wipe variables */
   /* memset(W, 0, sizeof(W)); */
   /* memset(T, 0, sizeof(T)); */
@@ -175,6 +181,32 @@ static void Sha256_WriteByteBlock(CSha256 *p)
 #undef s0
 #undef s1
 
+static SHA256_FUNC_UPDATE_BLOCKS g_FUNC_UPDATE_BLOCKS = Sha256_UpdateBlocks;
+static SHA256_FUNC_UPDATE_LANES g_FUNC_UPDATE_LANES = NULL;
+
+/* SHA extensions hash one message faster than AVX2 code hashes 8 messages,
+   so multi-buffer code is used only without them */
+
+void Sha256Prepare(void)
+{
+  SHA256_FUNC_UPDATE_BLOCKS f = Sha256_GetFunc_HW();
+  if (f)
+    g_FUNC_UPDATE_BLOCKS = f;
+  else
+    g_FUNC_UPDATE_LANES = Sha256_GetFunc_AVX2();
+}
+
+BoolInt Sha256_IsSupported_Lanes(void)
+{
+  return g_FUNC_UPDATE_LANES != NULL;
+}
+
+void Sha256_UpdateLanes(UInt32 states[SHA256_NUM_LANES][8], const Byte *const data[SHA256_NUM_LANES], size_t numBlocks)
+{
+  if (numBlocks != 0)
+    g_FUNC_UPDATE_LANES(states, data, numBlocks);
+}
+
 void Sha256_Update(CSha256 *p, const Byte *data, size_t size)
 {
   if (size == 0)
@@ -186,26 +218,28 @@ void Sha256_Update(CSha256 *p, const Byte *data, size_t size)
     
     p->count += size;
     
-    num = 64 - pos;
-    if (num > size)
+    if (pos != 0)
     {
-      memcpy(p->buffer + pos, data, size);
-      return;
+      num = 64 - pos;
+      if (num > size)
+      {
+        memcpy(p->buffer + pos, data, size);
+        return;
+      }
+      
+      size -= num;
+      memcpy(p->buffer + pos, data, num);
+      data += num;
+      g_FUNC_UPDATE_BLOCKS(p->state, p->buffer, 1);
     }
-    
-    size -= num;
-    memcpy(p->buffer + pos, data, num);
-    data += num;
   }
 
-  for (;;)
   {
-    Sha256_WriteByteBlock(p);
-    if (size < 64)
-      break;
-    size -= 64;
-    memcpy(p->buffer, data, 64);
-    data += 64;
+    size_t numBlocks = size >> 6;
+    if (numBlocks != 0)
+      g_FUNC_UPDATE_BLOCKS(p->state, data, numBlocks);
+    data += numBlocks << 6;
+    size &= 0x3F;
   }
 
   if (size != 0)
@@ -223,7 +257,7 @@ void Sha256_Final(CSha256 *p, Byte *digest)
   {
     pos &= 0x3F;
     if (pos == 0)
-      Sha256_WriteByteBlock(p);
+      g_FUNC_UPDATE_BLOCKS(p->state, p->buffer, 1);
     p->buffer[pos++] = 0;
   }
 
@@ -233,7 +267,7 @@ void Sha256_Final(CSha256 *p, Byte *digest)
     SetBe32(p->buffer + 64 - 4, (UInt32)(numBits));
   }
   
-  Sha256_WriteByteBlock(p);
+  g_FUNC_UPDATE_BLOCKS(p->state, p->buffer, 1);
 
   for (i = 0; i < 8; i += 2)
   {
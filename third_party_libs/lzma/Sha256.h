@@ -21,6 +21,31 @@ void Sha256_Init(CSha256 *p);
 void Sha256_Update(CSha256 *p, const Byte *data, size_t size);
 void Sha256_Final(CSha256 *p, Byte *digest);
 
+/* Sha256Prepare() selects the fastest code for this CPU (x86 SHA extensions, AVX2),
+   call it once before hashing */
+
+void Sha256Prepare(void);
+
+/* hashing of SHA256_NUM_LANES independent messages at once,
+   Sha256_UpdateLanes() can be called only if Sha256_IsSupported_Lanes() */
+
+#define SHA256_NUM_LANES 8
+
+BoolInt Sha256_IsSupported_Lanes(void);
+void Sha256_UpdateLanes(UInt32 states[SHA256_NUM_LANES][8], const Byte *const data[SHA256_NUM_LANES], size_t numBlocks);
+
+/* internal code of CPU specific implementations (Sha256Opt.c) */
+
+extern const UInt32 SHA256_K_ARRAY[64];
+
+typedef void (MY_FAST_CALL *SHA256_FUNC_UPDATE_BLOCKS)(UInt32 state[8], const Byte *data, size_t numBlocks);
+typedef void (MY_FAST_CALL *SHA256_FUNC_UPDATE_LANES)(UInt32 states[SHA256_NUM_LANES][8], const Byte *const data[SHA256_NUM_LANES], size_t numBlocks);
+
+/* they return NULL if there is no such code for this CPU or compiler */
+
+SHA256_FUNC_UPDATE_BLOCKS Sha256_GetFunc_HW(void);
+SHA256_FUNC_UPDATE_LANES Sha256_GetFunc_AVX2(void);
+
 EXTERN_C_END
 
 #endif
@@ -0,0 +1,229 @@
+/* Sha256Opt.c -- SHA-256 optimized code for x86 SHA extensions and AVX2
+Public domain */
+
+#include "Precomp.h"
+
+#include "CpuArch.h"
+#include "Sha256.h"
+
+#ifdef MY_CPU_X86_OR_AMD64
+
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+  #define USE_HW_SHA
+  #define ATTRIB_SHA __attribute__((__target__("sha,ssse3,sse4.1")))
+  #define ATTRIB_AVX2 __attribute__((__target__("avx2")))
+#elif defined(_MSC_VER) && (_MSC_VER >= 1900)
+  #define USE_HW_SHA
+  #define ATTRIB_SHA
+  #define ATTRIB_AVX2
+#endif
+
+#endif
+
+#ifdef USE_HW_SHA
+
+#include <immintrin.h>
+
+/*
+SHA extensions keep state in two registers: (A,B,E,F) and (C,D,G,H).
+_mm_sha256rnds2_epu32() makes 2 rounds, so 4 rounds use low and high halves of (W + K).
+*/
+
+#define SHA256_ROUNDS4(k, m) \
+  msg = _mm_add_epi32(m, _mm_loadu_si128((const __m128i *)(const void *)(SHA256_K_ARRAY + (k) * 4))); \
+  state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+  msg = _mm_shuffle_epi32(msg, 0x0E); \
+  state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+/* next = W[t+4..t+7] of message schedule from current (cur) and previous (prev) words */
+#define SHA256_MSG2(cur, prev, next) \
+  next = _mm_add_epi32(next, _mm_alignr_epi8(cur, prev, 4)); \
+  next = _mm_sha256msg2_epu32(next, cur);
+
+#define SHA256_MSG1(prev, cur) \
+  prev = _mm_sha256msg1_epu32(prev, cur);
+
+#define SHA256_LOAD(m, i) \
+  m = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(const void *)(data + (i) * 16)), mask);
+
+ATTRIB_SHA
+static void MY_FAST_CALL Sha256_UpdateBlocks_HW(UInt32 state[8], const Byte *data, size_t numBlocks)
+{
+  const __m128i mask = _mm_set_epi32(0x0c0d0e0f, 0x08090a0b, 0x04050607, 0x00010203);
+  __m128i state0, state1, tmp, msg;
+  __m128i m0, m1, m2, m3;
+
+  tmp = _mm_loadu_si128((const __m128i *)(const void *)&state[0]);
+  state1 = _mm_loadu_si128((const __m128i *)(const void *)&state[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);          /* C D A B */
+  state1 = _mm_shuffle_epi32(state1, 0x1B);    /* E F G H */
+  state0 = _mm_alignr_epi8(tmp, state1, 8);    /* A B E F */
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0); /* C D G H */
+
+  do
+  {
+    const __m128i abef = state0;
+    const __m128i cdgh = state1;
+
+    SHA256_LOAD(m0, 0)
+    SHA256_LOAD(m1, 1)
+    SHA256_LOAD(m2, 2)
+    SHA256_LOAD(m3, 3)
+
+    SHA256_ROUNDS4(0, m0)
+    SHA256_ROUNDS4(1, m1)  SHA256_MSG1(m0, m1)
+    SHA256_ROUNDS4(2, m2)  SHA256_MSG1(m1, m2)
+    SHA256_ROUNDS4(3, m3)  SHA256_MSG2(m3, m2, m0)  SHA256_MSG1(m2, m3)
+    SHA256_ROUNDS4(4, m0)  SHA256_MSG2(m0, m3, m1)  SHA256_MSG1(m3, m0)
+    SHA256_ROUNDS4(5, m1)  SHA256_MSG2(m1, m0, m2)  SHA256_MSG1(m0, m1)
+    SHA256_ROUNDS4(6, m2)  SHA256_MSG2(m2, m1, m3)  SHA256_MSG1(m1, m2)
+    SHA256_ROUNDS4(7, m3)  SHA256_MSG2(m3, m2, m0)  SHA256_MSG1(m2, m3)
+    SHA256_ROUNDS4(8, m0)  SHA256_MSG2(m0, m3, m1)  SHA256_MSG1(m3, m0)
+    SHA256_ROUNDS4(9, m1)  SHA256_MSG2(m1, m0, m2)  SHA256_MSG1(m0, m1)
+    SHA256_ROUNDS4(10, m2) SHA256_MSG2(m2, m1, m3)  SHA256_MSG1(m1, m2)
+    SHA256_ROUNDS4(11, m3) SHA256_MSG2(m3, m2, m0)  SHA256_MSG1(m2, m3)
+    SHA256_ROUNDS4(12, m0) SHA256_MSG2(m0, m3, m1)  SHA256_MSG1(m3, m0)
+    SHA256_ROUNDS4(13, m1) SHA256_MSG2(m1, m0, m2)
+    SHA256_ROUNDS4(14, m2) SHA256_MSG2(m2, m1, m3)
+    SHA256_ROUNDS4(15, m3)
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    data += 64;
+  }
+  while (--numBlocks != 0);
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);       /* F E B A */
+  state1 = _mm_shuffle_epi32(state1, 0xB1);    /* D C H G */
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0); /* D C B A */
+  state1 = _mm_alignr_epi8(state1, tmp, 8);    /* H G F E */
+  _mm_storeu_si128((__m128i *)(void *)&state[0], state0);
+  _mm_storeu_si128((__m128i *)(void *)&state[4], state1);
+}
+
+/*
+AVX2 code hashes 8 messages at once: every 32-bit lane of a register
+belongs to its own message, so the scalar round code is used as is.
+*/
+
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+#define S0_8(x) _mm256_xor_si256(ROTR8(x, 2), _mm256_xor_si256(ROTR8(x, 13), ROTR8(x, 22)))
+#define S1_8(x) _mm256_xor_si256(ROTR8(x, 6), _mm256_xor_si256(ROTR8(x, 11), ROTR8(x, 25)))
+#define s0_8(x) _mm256_xor_si256(ROTR8(x, 7), _mm256_xor_si256(ROTR8(x, 18), _mm256_srli_epi32(x, 3)))
+#define s1_8(x) _mm256_xor_si256(ROTR8(x, 17), _mm256_xor_si256(ROTR8(x, 19), _mm256_srli_epi32(x, 10)))
+
+#define Ch8(x, y, z) _mm256_xor_si256(z, _mm256_and_si256(x, _mm256_xor_si256(y, z)))
+#define Maj8(x, y, z) _mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y)))
+
+/* load 8 big-endian words of every message and transpose them to W[i] of all lanes */
+
+ATTRIB_AVX2
+static void Sha256_LoadLanes_AVX2(__m256i *W, const Byte *const data[SHA256_NUM_LANES], size_t offset)
+{
+  const __m256i mask = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  __m256i r[8], t[8], u[8];
+  unsigned i;
+
+  for (i = 0; i < 8; i++)
+    r[i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(const void *)(data[i] + offset)), mask);
+
+  for (i = 0; i < 8; i += 2)
+  {
+    t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+    t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+  }
+
+  for (i = 0; i < 8; i += 4)
+  {
+    u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+    u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+    u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+    u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+  }
+
+  for (i = 0; i < 4; i++)
+  {
+    W[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+    W[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+  }
+}
+
+ATTRIB_AVX2
+static void MY_FAST_CALL Sha256_UpdateLanes_AVX2(UInt32 states[SHA256_NUM_LANES][8], const Byte *const data[SHA256_NUM_LANES], size_t numBlocks)
+{
+  __m256i S[8], T[8], W[16];
+  size_t offset = 0;
+  unsigned i, j;
+
+  for (i = 0; i < 8; i++)
+    S[i] = _mm256_setr_epi32(
+        (int)states[0][i], (int)states[1][i], (int)states[2][i], (int)states[3][i],
+        (int)states[4][i], (int)states[5][i], (int)states[6][i], (int)states[7][i]);
+
+  do
+  {
+    Sha256_LoadLanes_AVX2(W, data, offset);
+    Sha256_LoadLanes_AVX2(W + 8, data, offset + 32);
+
+    for (i = 0; i < 8; i++)
+      T[i] = S[i];
+
+    for (j = 0; j < 64; j++)
+    {
+      __m256i t1, t2;
+      if (j >= 16)
+        W[j & 15] = _mm256_add_epi32(
+            _mm256_add_epi32(W[j & 15], s1_8(W[(j - 2) & 15])),
+            _mm256_add_epi32(W[(j - 7) & 15], s0_8(W[(j - 15) & 15])));
+      t1 = _mm256_add_epi32(
+          _mm256_add_epi32(T[7], S1_8(T[4])),
+          _mm256_add_epi32(Ch8(T[4], T[5], T[6]),
+              _mm256_add_epi32(_mm256_set1_epi32((int)SHA256_K_ARRAY[j]), W[j & 15])));
+      t2 = _mm256_add_epi32(S0_8(T[0]), Maj8(T[0], T[1], T[2]));
+      T[7] = T[6];
+      T[6] = T[5];
+      T[5] = T[4];
+      T[4] = _mm256_add_epi32(T[3], t1);
+      T[3] = T[2];
+      T[2] = T[1];
+      T[1] = T[0];
+      T[0] = _mm256_add_epi32(t1, t2);
+    }
+
+    for (i = 0; i < 8; i++)
+      S[i] = _mm256_add_epi32(S[i], T[i]);
+    offset += 64;
+  }
+  while (--numBlocks != 0);
+
+  for (i = 0; i < 8; i++)
+  {
+    UInt32 lanes[8];
+    _mm256_storeu_si256((__m256i *)(void *)lanes, S[i]);
+    for (j = 0; j < 8; j++)
+      states[j][i] = lanes[j];
+  }
+}
+
+#endif
+
+SHA256_FUNC_UPDATE_BLOCKS Sha256_GetFunc_HW(void)
+{
+  #ifdef USE_HW_SHA
+  if (CPU_IsSupported_SHA())
+    return Sha256_UpdateBlocks_HW;
+  #endif
+  return NULL;
+}
+
+SHA256_FUNC_UPDATE_LANES Sha256_GetFunc_AVX2(void)
+{
+  #ifdef USE_HW_SHA
+  if (CPU_IsSupported_AVX2())
+    return Sha256_UpdateLanes_AVX2;
+  #endif
+  return NULL;
+}
@@ -29,8 +29,6 @@
   UInt64 MY_FAST_CALL XzCrc64UpdateT4(UInt64 v, const void *data, size_t size, const UInt64 *table);
 #endif
 
-typedef UInt64 (MY_FAST_CALL *CRC64_FUNC)(UInt64 v, const void *data, size_t size, const UInt64 *table);
-
 static CRC64_FUNC g_Crc64Update;
 UInt64 g_Crc64Table[256 * CRC64_NUM_TABLES];
 
@@ -64,6 +62,11 @@ void MY_FAST_CALL Crc64GenerateTable()
   #ifdef MY_CPU_LE
 
   g_Crc64Update = XzCrc64UpdateT4;
+  {
+    CRC64_FUNC f = Crc64GetFunc_Clmul();
+    if (f)
+      g_Crc64Update = f;
+  }
 
   #else
   {
@@ -21,6 +21,11 @@ void MY_FAST_CALL Crc64GenerateTable(void);
 UInt64 MY_FAST_CALL Crc64Update(UInt64 crc, const void *data, size_t size);
 UInt64 MY_FAST_CALL Crc64Calc(const void *data, size_t size);
 
+typedef UInt64 (MY_FAST_CALL *CRC64_FUNC)(UInt64 v, const void *data, size_t size, const UInt64 *table);
+
+/* CRC code with carry-less multiplication (CrcClmul.c), NULL if CPU or compiler has no such code */
+CRC64_FUNC Crc64GetFunc_Clmul(void);
+
 EXTERN_C_END
 
 #endif